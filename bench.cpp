@@ -0,0 +1,304 @@
+// 性能基准
+// 编译: 见 README, 运行: ./bench [--max-mb N] [--git-iterations N]
+// 直接包含 main.cpp, 用 LAB_BENCH 去掉原来的 main
+#define LAB_BENCH
+#include "main.cpp"
+
+#include <new>
+
+// 统计堆分配次数和字节数
+// 只能看到经过 operator new 的C++分配, libgit2/ncurses/zstd 直接调用 malloc 的部分不计入
+std::atomic<bool> bench_counting(false);
+std::atomic<uint64_t> bench_allocs(0);
+std::atomic<uint64_t> bench_alloc_bytes(0);
+
+void *operator new(size_t size)
+{
+    if (bench_counting.load(std::memory_order_relaxed))
+    {
+        bench_allocs.fetch_add(1, std::memory_order_relaxed);
+        bench_alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+    }
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    std::free(p);
+}
+
+struct benchResult
+{
+    std::string name;
+    std::string size;
+    double bestMs = 0;
+    double medianMs = 0;
+    double mbPerSec = 0; // bytes 为0时不显示
+    uint64_t allocs = 0; // 每次运行的平均值, 只含C++分配
+    uint64_t allocBytes = 0;
+};
+
+std::vector<benchResult> bench_results;
+
+// 运行 fn reps 次, 记录最好和中位数耗时
+// setup 在每次运行前调用, 不计时也不统计分配
+benchResult bench_measure(const std::string &name, const std::string &size, uint64_t bytes, int reps,
+                          const std::function<void()> &fn, const std::function<void()> &setup = nullptr)
+{
+    std::vector<double> times;
+    bench_allocs = 0;
+    bench_alloc_bytes = 0;
+    for (int i = 0; i < reps; ++i)
+    {
+        if (setup)
+            setup();
+        auto begin = std::chrono::steady_clock::now();
+        bench_counting = true;
+        fn();
+        bench_counting = false;
+        times.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count());
+    }
+    std::sort(times.begin(), times.end());
+    benchResult result;
+    result.name = name;
+    result.size = size;
+    result.bestMs = times.front();
+    result.medianMs = times[times.size() / 2];
+    result.mbPerSec = bytes && result.bestMs > 0 ? bytes / 1048576.0 / (result.bestMs / 1000) : 0;
+    result.allocs = bench_allocs / reps;
+    result.allocBytes = bench_alloc_bytes / reps;
+    bench_results.push_back(result);
+    printf("%-22s %8s %10.3f %10.3f %9.1f %10llu %12llu\n", result.name.c_str(), result.size.c_str(),
+           result.bestMs, result.medianMs, result.mbPerSec,
+           (unsigned long long)result.allocs, (unsigned long long)result.allocBytes);
+    fflush(stdout);
+    return result;
+}
+
+std::string bench_size_label(uint64_t bytes)
+{
+    char label[16];
+    if (bytes >= 1048576)
+        snprintf(label, sizeof(label), "%lluMB", (unsigned long long)(bytes / 1048576));
+    else
+        snprintf(label, sizeof(label), "%lluKB", (unsigned long long)(bytes / 1024));
+    return label;
+}
+
+// 生成包含关键字/字符串/注释/变量/数字的shell脚本
+void bench_generate_script(const std::filesystem::path &path, uint64_t bytes)
+{
+    static const char *lines[] = {
+        "#!/bin/bash\n",
+        "# 统计目录中的文件数量 count files in the directory\n",
+        "for file in \"$DIR\"/*.txt; do\n",
+        "    if [ -f \"$file\" ]; then\n",
+        "        count=$((count + 1))\n",
+        "        echo \"found: ${file##*/} size=$(stat -c %s \"$file\")\"\n",
+        "    elif [ -d \"$file\" ]; then\n",
+        "        echo 'skip directory' >&2\n",
+        "    fi\n",
+        "done\n",
+        "case \"$1\" in start) run 10 20 30 ;; stop) exit 0 ;; esac\n",
+        "while read -r line; do printf '%s\\n' \"$line\" | awk '{print $1, $3}' >> out.log; done < input.txt\n",
+    };
+    std::ofstream out(path, std::ios::trunc);
+    uint64_t written = 0;
+    for (size_t i = 0; written < bytes; ++i)
+    {
+        const char *line = lines[i % (sizeof(lines) / sizeof(lines[0]))];
+        out << line;
+        written += strlen(line);
+    }
+}
+
+// FileDisplay 各阶段, 通过 newterm 输出到 /dev/null
+void bench_file_display(const std::filesystem::path &dir, uint64_t maxBytes)
+{
+    setlocale(LC_ALL, "");
+    setenv("LINES", "50", 1);
+    setenv("COLUMNS", "200", 1);
+    if (!getenv("TERM"))
+        setenv("TERM", "xterm", 1);
+    FILE *out = fopen("/dev/null", "w");
+    FILE *in = fopen("/dev/null", "r");
+    SCREEN *screen = newterm(nullptr, out, in);
+    set_term(screen);
+    start_color();
+    WINDOW *window = newwin(48, 100, 0, 0);
+
+    for (uint64_t bytes : {1ull << 10, 64ull << 10, 1ull << 20, 16ull << 20, 100ull << 20})
+    {
+        if (bytes > maxBytes)
+            break;
+        std::filesystem::path path = dir / ("bench-" + std::to_string(bytes) + ".sh");
+        bench_generate_script(path, bytes);
+        std::string label = bench_size_label(bytes);
+        int reps = bytes <= 1048576 ? 20 : 3;
+
+        FileDisplay display(window, path);
+        bench_measure("FileDisplay::loadFile", label, bytes, reps, [&]()
+                      { display.loadFile(path); });
+        bench_measure("analyzeSyntax", label, bytes, reps, [&]()
+                      { display.analyzeSyntax(); });
+        bench_measure("rewrapLines", label, bytes, reps, [&]()
+                      { display.rewrapLines(); });
+        bench_measure("refreshDisplay x100", label, 0, reps, [&]()
+                      {
+                          for (int i = 0; i < 100; ++i)
+                          {
+                              display.handleInput(i < 50 ? KEY_NPAGE : KEY_PPAGE);
+                          } });
+        std::filesystem::remove(path);
+    }
+
+    delwin(window);
+    endwin();
+    delscreen(screen);
+    fclose(out);
+    fclose(in);
+}
+
+// git 操作失败时计时没有意义, 中止基准
+void bench_check(bool ok, const std::string &what)
+{
+    if (!ok)
+        throw std::runtime_error(what + " failed");
+}
+
+// 分支固定为 master, 与推送/拉取使用的引用一致
+bool bench_init_repo(const std::filesystem::path &path, const std::string &url)
+{
+    if (!git_init_with_config(path.string(), "bench", "bench@example.com") ||
+        !git_remote_add_origin(path.string(), url))
+        return false;
+    git_repository *repo = nullptr;
+    bool ok = git_repository_open(&repo, path.c_str()) == 0 &&
+              git_repository_set_head(repo, "refs/heads/master") == 0;
+    git_repository_free(repo);
+    return ok;
+}
+
+// git 操作, 远程为本地 file:// 裸仓库
+void bench_git(const std::filesystem::path &dir, int iterations)
+{
+    std::filesystem::path bare = dir / "remote.git";
+    std::filesystem::path work = dir / "work";
+    std::filesystem::path clone = dir / "clone";
+    std::string url = "file://" + bare.string();
+
+    git_repository *remote = nullptr;
+    if (git_repository_init(&remote, bare.c_str(), 1) < 0)
+    {
+        std::cerr << "Error: cannot create " << bare << std::endl;
+        return;
+    }
+    git_repository_free(remote);
+    if (!bench_init_repo(work, url) || !bench_init_repo(clone, url))
+    {
+        std::cerr << "Error: cannot create work repositories" << std::endl;
+        return;
+    }
+
+    // 和学生仓库相近: 4个实验目录, 每个目录若干文件
+    for (int lab = 1; lab <= 4; ++lab)
+    {
+        std::filesystem::create_directories(work / ("lab" + std::to_string(lab)));
+        for (int i = 0; i < 50; ++i)
+            bench_generate_script(work / ("lab" + std::to_string(lab)) / ("file" + std::to_string(i) + ".sh"), 4096);
+    }
+    bench_check(git_add_all(work.string()), "git_add_all");
+    bench_check(use_git_commit(work.string(), "initial"), "use_git_commit");
+    bench_check(use_git_push(work.string(), url) == 0, "use_git_push");
+    std::string clonePath = clone.string();
+    bench_check(use_git_pull(clonePath) >= 0, "use_git_pull");
+
+    int round = 0;
+    auto modify = [&]()
+    {
+        std::ofstream out(work / "lab1" / "lab1.sh", std::ios::app);
+        out << "echo round " << round++ << "\n";
+    };
+    std::string size = std::to_string(iterations) + "x";
+    bench_measure("git_add_all", size, 0, iterations, [&]()
+                  { bench_check(git_add_all(work.string()), "git_add_all"); }, modify);
+    // 每次只提交一个变化的文件
+    bench_measure("use_git_commit", size, 0, iterations, [&]()
+                  { bench_check(use_git_commit(work.string(), "bench commit"), "use_git_commit"); }, [&]()
+                  {
+                      modify();
+                      bench_check(git_add_all(work.string()), "git_add_all"); });
+    bench_measure("use_git_push", size, 0, iterations, [&]()
+                  { bench_check(use_git_push(work.string(), url) == 0, "use_git_push"); }, [&]()
+                  {
+                      modify();
+                      bench_check(git_add_all(work.string()), "git_add_all");
+                      bench_check(use_git_commit(work.string(), "bench push"), "use_git_commit"); });
+    // 每轮先推送一个新提交, 再在另一个仓库中快进拉取
+    bench_measure("use_git_pull", size, 0, iterations, [&]()
+                  { bench_check(use_git_pull(clonePath) > 0, "use_git_pull"); }, [&]()
+                  {
+                      modify();
+                      bench_check(git_add_all(work.string()), "git_add_all");
+                      bench_check(use_git_commit(work.string(), "bench pull"), "use_git_commit");
+                      bench_check(use_git_push(work.string(), url) == 0, "use_git_push");
+                      std::filesystem::remove(remote_state_path(clone)); });
+    // 远程状态未过期时跳过网络
+    bench_measure("use_git_pull (fresh)", size, 0, iterations, [&]()
+                  { bench_check(use_git_pull(clonePath) == 0, "use_git_pull"); });
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t maxMb = 100;
+    int gitIterations = 10;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--max-mb" && i + 1 < argc)
+            maxMb = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--git-iterations" && i + 1 < argc)
+            gitIterations = std::max(1, std::atoi(argv[++i]));
+        else
+        {
+            std::cout << "Usage: " << argv[0] << " [--max-mb N] [--git-iterations N]" << std::endl;
+            return 1;
+        }
+    }
+
+    std::string pattern = (std::filesystem::temp_directory_path() / "lab-bench-XXXXXX").string();
+    if (!mkdtemp(&pattern[0]))
+    {
+        std::cerr << "Error: cannot create temporary directory" << std::endl;
+        return 1;
+    }
+    std::filesystem::path dir = pattern;
+
+    printf("%-22s %8s %10s %10s %9s %10s %12s\n", "benchmark", "size", "best ms", "median ms", "MB/s",
+           "C++ allocs", "C++ bytes");
+    int status = 0;
+    bench_file_display(dir, maxMb * 1048576);
+    git_libgit2_init();
+    try
+    {
+        bench_git(dir, gitIterations);
+    }
+    catch (const std::runtime_error &e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        status = 1;
+    }
+    git_libgit2_shutdown();
+
+    std::error_code ec;
+    std::filesystem::remove_all(dir, ec);
+    remove_session_runtime_dir();
+    return status;
+}
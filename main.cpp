@@ -18,8 +18,338 @@
 #include <sys/wait.h>
 #include <git2/sys/transport.h>
 #include <git2/sys/credential.h>
+#include <zstd.h>
+#include <ctime>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <fcntl.h>
+#include <list>
+#include <deque>
+#include <sstream>
+#include <memory>
+#include <unordered_map>
+#include <functional>
+#include <spawn.h>
+#include <csignal>
+#include <cmath>
+#include <clocale>
+#include <pty.h>
+#include <termios.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#define PULL_FETCH_DEPTH 1 // 新仓库首次拉取的浅拉取深度, 0为完整历史
+#define PUSH_EXIT_WAIT_MS 5000 // 退出时等待推送的最长时间
+#define PUSH_CANCEL_WAIT_MS 1000 // 取消推送后等待后台线程退出的最长时间
+
+// 性能追踪
+// 以 --trace out.json 启动时记录各阶段耗时, 退出时写出 Chrome trace-event 格式(chrome://tracing 或 Perfetto 打开)
+// 未启用时每个 TRACE_SPAN 只有一次布尔判断
+struct traceEvent
+{
+    const char *name;
+    const char *category;
+    long long start; // 微秒
+    long long duration;
+    int tid;
+};
+
+struct traceState
+{
+    std::atomic<bool> enabled{false};
+    std::string path;
+    std::mutex mutex;
+    std::vector<traceEvent> events;
+    std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+    std::atomic<int> nextTid{1};
+};
+
+traceState &trace_state()
+{
+    static traceState state;
+    return state;
+}
+
+long long trace_now()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now() - trace_state().origin)
+        .count();
+}
+
+int trace_tid()
+{
+    thread_local int tid = trace_state().nextTid++;
+    return tid;
+}
+
+void trace_enable(const std::string &path)
+{
+    trace_state().path = path;
+    trace_state().enabled = true;
+}
+
+// 作用域内的耗时记为一个完整事件("ph":"X"), name 为空时不记录
+class traceSpan
+{
+private:
+    const char *name;
+    const char *category;
+    long long start;
+
+public:
+    traceSpan(const char *spanName, const char *spanCategory = "app")
+        : name(trace_state().enabled ? spanName : nullptr), category(spanCategory), start(0)
+    {
+        if (name)
+            start = trace_now();
+    }
+
+    ~traceSpan()
+    {
+        if (!name)
+            return;
+        traceEvent event{name, category, start, trace_now() - start, trace_tid()};
+        std::lock_guard<std::mutex> lock(trace_state().mutex);
+        trace_state().events.push_back(event);
+    }
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SPAN(name, category) traceSpan TRACE_CONCAT(traceSpan_, __LINE__)(name, category)
+
+bool trace_write()
+{
+    traceState &state = trace_state();
+    if (!state.enabled)
+        return true;
+    std::lock_guard<std::mutex> lock(state.mutex);
+    std::ofstream out(state.path, std::ios::trunc);
+    if (!out.is_open())
+        return false;
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    for (size_t i = 0; i < state.events.size(); ++i)
+    {
+        const traceEvent &event = state.events[i];
+        out << (i ? ",\n" : "") << "{\"name\":" << nlohmann::json(event.name).dump()
+            << ",\"cat\":\"" << event.category << "\",\"ph\":\"X\",\"ts\":" << event.start
+            << ",\"dur\":" << event.duration << ",\"pid\":" << getpid() << ",\"tid\":" << event.tid << "}";
+    }
+    out << "\n]}\n";
+    return (bool)out;
+}
+
+// 界面延迟统计
+// 按键到画面更新的延迟和每帧写到终端的字节数记入对数分桶直方图(HDR风格, 相对误差约3%)
+#define HDR_SUB_BUCKET_BITS 5 // 每个2的幂区间再分32格
+#define HDR_BUCKETS (64 << HDR_SUB_BUCKET_BITS)
+class hdrHistogram
+{
+private:
+    std::vector<uint64_t> counts;
+    uint64_t total;
+    uint64_t maxValue;
+
+    static size_t indexOf(uint64_t value)
+    {
+        const uint64_t sub = 1ull << HDR_SUB_BUCKET_BITS;
+        if (value < sub)
+            return value;
+        int shift = (63 - __builtin_clzll(value)) - HDR_SUB_BUCKET_BITS;
+        return ((size_t)(shift + 1) << HDR_SUB_BUCKET_BITS) + ((value >> shift) - sub);
+    }
+
+    static uint64_t lowerBound(size_t index)
+    {
+        const uint64_t sub = 1ull << HDR_SUB_BUCKET_BITS;
+        if (index < sub)
+            return index;
+        int shift = (index >> HDR_SUB_BUCKET_BITS) - 1;
+        return (sub + (index & (sub - 1))) << shift;
+    }
+
+    static uint64_t upperBound(size_t index)
+    {
+        return index + 1 < HDR_BUCKETS ? lowerBound(index + 1) - 1 : UINT64_MAX;
+    }
+
+public:
+    hdrHistogram()
+        : counts(HDR_BUCKETS, 0), total(0), maxValue(0)
+    {
+    }
+
+    void record(uint64_t value)
+    {
+        counts[indexOf(value)]++;
+        total++;
+        maxValue = std::max(maxValue, value);
+    }
+
+    uint64_t count() const
+    {
+        return total;
+    }
+
+    uint64_t max() const
+    {
+        return maxValue;
+    }
+
+    // 返回所在分桶的上界
+    uint64_t percentile(double p) const
+    {
+        if (total == 0)
+            return 0;
+        uint64_t target = std::max<uint64_t>(1, (uint64_t)std::ceil(total * p / 100));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts.size(); ++i)
+        {
+            seen += counts[i];
+            if (seen >= target)
+                return std::min(upperBound(i), maxValue);
+        }
+        return maxValue;
+    }
+
+    // 只输出非空分桶: [下界, 上界, 次数]
+    nlohmann::json toJson() const
+    {
+        nlohmann::json data;
+        data["count"] = total;
+        data["p50"] = percentile(50);
+        data["p90"] = percentile(90);
+        data["p99"] = percentile(99);
+        data["max"] = maxValue;
+        data["buckets"] = nlohmann::json::array();
+        for (size_t i = 0; i < counts.size(); ++i)
+            if (counts[i])
+                data["buckets"].push_back({lowerBound(i), upperBound(i), counts[i]});
+        return data;
+    }
+};
+
+// 界面线程写出的字节数
+// ncurses 6 用 write(2) 直接写输出描述符(并在该描述符上设置终端模式), 没有可挂接的 FILE* 或回调;
+// 这里读取创建者线程自己的 I/O 统计(/proc/thread-self/io 的 wchar), 后台线程的写入不计入
+class threadWriteCounter
+{
+private:
+    int fd;
+
+public:
+    threadWriteCounter()
+        : fd(open("/proc/thread-self/io", O_RDONLY | O_CLOEXEC))
+    {
+    }
+
+    ~threadWriteCounter()
+    {
+        if (fd >= 0)
+            close(fd);
+    }
+
+    threadWriteCounter(const threadWriteCounter &) = delete;
+    threadWriteCounter &operator=(const threadWriteCounter &) = delete;
+
+    // 不可用时(没有 /proc)始终返回0
+    uint64_t bytes() const
+    {
+        char buf[512];
+        ssize_t n = fd < 0 ? -1 : pread(fd, buf, sizeof(buf) - 1, 0);
+        if (n <= 0)
+            return 0;
+        buf[n] = '\0';
+        const char *wchar = strstr(buf, "wchar:");
+        return wchar ? strtoull(wchar + 6, nullptr, 10) : 0;
+    }
+};
+
+class perfMonitor
+{
+private:
+    hdrHistogram latency;    // 微秒
+    hdrHistogram frameBytes; // 每帧字节数
+    threadWriteCounter writes; // 在界面线程中构造
+    bool pending;
+    std::chrono::steady_clock::time_point keyTime;
+    uint64_t keyBytes;
+    uint64_t totalBytes; // 各帧字节数之和
+
+public:
+    perfMonitor()
+        : pending(false), keyBytes(0), totalBytes(0)
+    {
+    }
+
+    // getch 返回按键时调用
+    void keyPressed()
+    {
+        pending = true;
+        keyTime = std::chrono::steady_clock::now();
+        keyBytes = writes.bytes();
+    }
+
+    // 按键的效果刷新到终端后调用, 同一次按键只记录第一次
+    void painted()
+    {
+        if (!pending)
+            return;
+        pending = false;
+        latency.record(std::chrono::duration_cast<std::chrono::microseconds>(
+                           std::chrono::steady_clock::now() - keyTime)
+                           .count());
+        uint64_t bytes = writes.bytes() - keyBytes;
+        frameBytes.record(bytes);
+        totalBytes += bytes;
+    }
+
+    // 按键没有产生画面更新
+    void discard()
+    {
+        pending = false;
+    }
+
+    const hdrHistogram &latencyUs() const
+    {
+        return latency;
+    }
 
-#define CHECK_PATH "/tmp/shellcheck_results.txt"
+    const hdrHistogram &bytesPerFrame() const
+    {
+        return frameBytes;
+    }
+
+    uint64_t terminalBytes() const
+    {
+        return totalBytes;
+    }
+
+    // 每次运行追加一行, 便于离线汇总
+    bool dump(const std::filesystem::path &path) const
+    {
+        if (latency.count() == 0)
+            return true;
+        nlohmann::json record;
+        record["time"] = std::time(nullptr);
+        const char *term = std::getenv("TERM");
+        record["term"] = term ? term : "";
+        record["ssh"] = std::getenv("SSH_CONNECTION") != nullptr;
+        record["key_to_paint_us"] = latency.toJson();
+        record["bytes_per_frame"] = frameBytes.toJson();
+        record["terminal_bytes"] = totalBytes;
+        std::ofstream out(path, std::ios::app);
+        out << record.dump() << "\n";
+        return (bool)out;
+    }
+};
 
 // class
 
@@ -49,14 +379,19 @@ private:
     std::vector<std::string> originalLines;
     std::vector<std::vector<HighlightType>> highlightInfo;
     std::vector<std::pair<std::string, std::vector<HighlightType>>> wrappedLines;
+    std::vector<int> wrappedSource; // 每个换行后的行对应的原始行号
+    std::vector<char> gutterMarks;  // 左侧标记栏, 按原始行号索引; 为空时不显示
+    bool plainText;                 // 不做Shell语法高亮(用于非脚本内容)
+    std::string pendingText;        // appendText 中尚未结束的行
     int topLine;
     int winHeight;
     int winWidth;
 
 public:
     FileDisplay(WINDOW *window, const std::string &file)
-        : filename(file), topLine(0)
+        : filename(file), plainText(false), topLine(0)
     {
+        TRACE_SPAN("FileDisplay", "file");
         int h, w;
         getmaxyx(window, h, w);
         win = derwin(window, h - 2, w - 2, 1, 1);
@@ -84,12 +419,14 @@ public:
             init_pair(4, COLOR_MAGENTA, COLOR_BLACK); // 数字
             init_pair(5, COLOR_BLUE, COLOR_BLACK);    // 变量
             init_pair(6, COLOR_YELLOW, COLOR_BLACK);  // 符号颜色
+            init_pair(7, COLOR_RED, COLOR_BLACK);     // 错误标记
         }
     }
 
     // 加载文件
     bool loadFile(const std::string &filename)
     {
+        TRACE_SPAN("load", "file");
         std::ifstream file(filename);
         if (!file.is_open())
         {
@@ -106,157 +443,253 @@ public:
         return true;
     }
 
-    // 分析语法高亮
-    void analyzeSyntax()
+    // 分析一行的语法高亮
+    std::vector<HighlightType> analyzeLine(const std::string &line) const
     {
-        highlightInfo.clear();
-        for (const auto &line : originalLines)
+        std::vector<HighlightType> lineInfo(line.length(), HighlightType::NORMAL);
+        if (plainText)
         {
-            std::vector<HighlightType> lineInfo(line.length(), HighlightType::NORMAL);
-            bool inString = false;
-            bool inComment = false;
-            bool escapeChar = false;
+            return lineInfo;
+        }
+        bool inString = false;
+        bool inComment = false;
+        bool escapeChar = false;
 
-            for (size_t i = 0; i < line.length(); ++i)
+        for (size_t i = 0; i < line.length(); ++i)
+        {
+            if (inComment)
             {
-                if (inComment)
-                {
-                    lineInfo[i] = HighlightType::COMMENT;
-                    continue;
-                }
+                lineInfo[i] = HighlightType::COMMENT;
+                continue;
+            }
 
-                if (escapeChar)
-                {
-                    escapeChar = false;
-                    continue;
-                }
+            if (escapeChar)
+            {
+                escapeChar = false;
+                continue;
+            }
 
-                if (line[i] == '\\')
-                {
-                    escapeChar = true;
-                    continue;
-                }
+            if (line[i] == '\\')
+            {
+                escapeChar = true;
+                continue;
+            }
 
-                if (line[i] == '"' || line[i] == '\'')
-                {
-                    inString = !inString;
-                    lineInfo[i] = HighlightType::STRING;
-                    continue;
-                }
+            if (line[i] == '"' || line[i] == '\'')
+            {
+                inString = !inString;
+                lineInfo[i] = HighlightType::STRING;
+                continue;
+            }
 
-                if (!inString && line[i] == '#')
-                {
-                    inComment = true;
-                    lineInfo[i] = HighlightType::COMMENT;
-                    continue;
-                }
+            if (!inString && line[i] == '#')
+            {
+                inComment = true;
+                lineInfo[i] = HighlightType::COMMENT;
+                continue;
+            }
 
-                if (inString)
-                {
-                    lineInfo[i] = HighlightType::STRING;
-                }
-                else if (isdigit(line[i]))
-                {
-                    lineInfo[i] = HighlightType::NUMBER;
-                }
-                else if (line[i] == '$')
+            if (inString)
+            {
+                lineInfo[i] = HighlightType::STRING;
+            }
+            else if (isdigit(line[i]))
+            {
+                lineInfo[i] = HighlightType::NUMBER;
+            }
+            else if (line[i] == '$')
+            {
+                lineInfo[i] = HighlightType::VARIABLE;
+                // 变量名部分也标记为变量
+                size_t j = i + 1;
+                while (j < line.length() && (isalnum(line[j]) || line[j] == '_'))
                 {
-                    lineInfo[i] = HighlightType::VARIABLE;
-                    // 变量名部分也标记为变量
-                    size_t j = i + 1;
-                    while (j < line.length() && (isalnum(line[j]) || line[j] == '_'))
-                    {
-                        lineInfo[j] = HighlightType::VARIABLE;
-                        j++;
-                    }
-                    i = j - 1;
+                    lineInfo[j] = HighlightType::VARIABLE;
+                    j++;
                 }
+                i = j - 1;
             }
-            highlightInfo.push_back(lineInfo);
         }
 
         // 识别关键字
-        for (size_t lineNum = 0; lineNum < originalLines.size(); ++lineNum)
+        auto &info = lineInfo;
+        size_t pos = 0;
+        while (pos < line.length())
         {
-            const auto &line = originalLines[lineNum];
-            auto &info = highlightInfo[lineNum];
-
-            size_t pos = 0;
-            while (pos < line.length())
+            // 跳过空白和已标记部分
+            while (pos < line.length() && (isspace(line[pos]) || info[pos] != HighlightType::NORMAL))
             {
-                // 跳过空白和已标记部分
-                while (pos < line.length() && (isspace(line[pos]) || info[pos] != HighlightType::NORMAL))
-                {
-                    pos++;
-                }
+                pos++;
+            }
 
-                if (pos >= line.length())
-                    break;
+            if (pos >= line.length())
+                break;
 
-                // 提取单词
-                size_t wordStart = pos;
-                while (pos < line.length() && !isspace(line[pos]) && info[pos] == HighlightType::NORMAL)
-                {
-                    pos++;
-                }
+            // 提取单词
+            size_t wordStart = pos;
+            while (pos < line.length() && !isspace(line[pos]) && info[pos] == HighlightType::NORMAL)
+            {
+                pos++;
+            }
 
-                std::string word = line.substr(wordStart, pos - wordStart);
-                if (SHELL_KEYWORDS.find(word) != SHELL_KEYWORDS.end())
+            std::string word = line.substr(wordStart, pos - wordStart);
+            if (SHELL_KEYWORDS.find(word) != SHELL_KEYWORDS.end())
+            {
+                for (size_t i = wordStart; i < wordStart + word.length(); ++i)
                 {
-                    for (size_t i = wordStart; i < wordStart + word.length(); ++i)
-                    {
-                        info[i] = HighlightType::KEYWORD;
-                    }
+                    info[i] = HighlightType::KEYWORD;
                 }
             }
-            // 识别符号
-            for (size_t i = 0; i < line.length(); ++i)
+        }
+        // 识别符号
+        for (size_t i = 0; i < line.length(); ++i)
+        {
+            if (info[i] == HighlightType::NORMAL &&
+                (line[i] == '=' || line[i] == '+' || line[i] == '-' ||
+                 line[i] == '*' || line[i] == '/' || line[i] == '|' ||
+                 line[i] == '&' || line[i] == '<' || line[i] == '>' ||
+                 line[i] == '(' || line[i] == ')' || line[i] == '[' ||
+                 line[i] == ']' || line[i] == '{' || line[i] == '}' ||
+                 line[i] == ';' || line[i] == ':'))
             {
-                if (info[i] == HighlightType::NORMAL &&
-                    (line[i] == '=' || line[i] == '+' || line[i] == '-' ||
-                     line[i] == '*' || line[i] == '/' || line[i] == '|' ||
-                     line[i] == '&' || line[i] == '<' || line[i] == '>' ||
-                     line[i] == '(' || line[i] == ')' || line[i] == '[' ||
-                     line[i] == ']' || line[i] == '{' || line[i] == '}' ||
-                     line[i] == ';' || line[i] == ':'))
-                {
-                    info[i] = HighlightType::SYMBOL;
-                }
+                info[i] = HighlightType::SYMBOL;
             }
         }
+        return lineInfo;
+    }
+
+    // 分析语法高亮
+    void analyzeSyntax()
+    {
+        TRACE_SPAN("highlight", "file");
+        highlightInfo.clear();
+        for (const auto &line : originalLines)
+        {
+            highlightInfo.push_back(analyzeLine(line));
+        }
+    }
+
+    // 文本区宽度(显示标记栏时让出两列)
+    int textWidth() const
+    {
+        return gutterMarks.empty() ? winWidth : std::max(1, winWidth - 2);
+    }
+
+    // 对一行原始文本计算换行
+    void wrapLine(size_t lineNum)
+    {
+        const auto &line = originalLines[lineNum];
+        const auto &info = highlightInfo[lineNum];
+
+        if (line.empty())
+        {
+            wrappedLines.emplace_back("", std::vector<HighlightType>());
+            wrappedSource.push_back(lineNum);
+            return;
+        }
+
+        size_t pos = 0;
+        while (pos < line.length())
+        {
+            int chunkSize = std::min((int)(line.length() - pos), textWidth());
+            wrappedLines.emplace_back(
+                line.substr(pos, chunkSize),
+                std::vector<HighlightType>(info.begin() + pos, info.begin() + pos + chunkSize));
+            wrappedSource.push_back(lineNum);
+            pos += chunkSize;
+        }
     }
 
     // 重新计算换行
     void rewrapLines()
     {
+        TRACE_SPAN("wrap", "file");
         wrappedLines.clear();
+        wrappedSource.clear();
 
         for (size_t lineNum = 0; lineNum < originalLines.size(); ++lineNum)
         {
-            const auto &line = originalLines[lineNum];
-            const auto &info = highlightInfo[lineNum];
+            wrapLine(lineNum);
+        }
+    }
 
-            if (line.empty())
-            {
-                wrappedLines.emplace_back("", std::vector<HighlightType>());
-                continue;
-            }
+    // 清空内容, 用于显示子进程输出等非文件内容
+    void clearContent()
+    {
+        originalLines.clear();
+        highlightInfo.clear();
+        wrappedLines.clear();
+        wrappedSource.clear();
+        pendingText.clear();
+        topLine = 0;
+    }
 
-            size_t pos = 0;
-            while (pos < line.length())
-            {
-                int chunkSize = std::min((int)(line.length() - pos), winWidth);
-                wrappedLines.emplace_back(
-                    line.substr(pos, chunkSize),
-                    std::vector<HighlightType>(info.begin() + pos, info.begin() + pos + chunkSize));
-                pos += chunkSize;
-            }
+    void setPlainText(bool plain)
+    {
+        plainText = plain;
+    }
+
+    size_t lineCount() const
+    {
+        return originalLines.size();
+    }
+
+    // 设置标记栏, marks[i] 为第i行(从0开始)的标记字符, 空格表示无标记
+    void setGutterMarks(const std::vector<char> &marks)
+    {
+        gutterMarks = marks;
+        rewrapLines();
+        topLine = std::max(0, std::min(topLine, (int)wrappedLines.size() - 1));
+    }
+
+    // 当前顶部显示的原始行号(从0开始)
+    int currentLine() const
+    {
+        return wrappedSource.empty() ? 0 : wrappedSource[topLine];
+    }
+
+    // 滚动到原始行号 line(从0开始)所在的第一行, 二分查找
+    void jumpToLine(int line)
+    {
+        auto it = std::lower_bound(wrappedSource.begin(), wrappedSource.end(), line);
+        topLine = std::max(0, std::min((int)(it - wrappedSource.begin()), (int)wrappedLines.size() - 1));
+        refreshDisplay();
+    }
+
+    // 追加一段文本(可能不以换行结束), 只分析新增的完整行
+    void appendText(const std::string &text)
+    {
+        pendingText += text;
+        size_t start = 0, end;
+        while ((end = pendingText.find('\n', start)) != std::string::npos)
+        {
+            appendLine(pendingText.substr(start, end - start));
+            start = end + 1;
+        }
+        pendingText.erase(0, start);
+    }
+
+    // 输出结束时补上最后一个不完整的行
+    void finishText()
+    {
+        if (!pendingText.empty())
+        {
+            appendLine(pendingText);
+            pendingText.clear();
         }
     }
 
+    void appendLine(const std::string &line)
+    {
+        originalLines.push_back(line);
+        highlightInfo.push_back(analyzeLine(line));
+        wrapLine(originalLines.size() - 1);
+    }
+
     // 刷新显示
     void refreshDisplay()
     {
+        TRACE_SPAN("render", "ui");
         werase(win);
         int linesToShow = std::min(winHeight, (int)wrappedLines.size() - topLine);
 
@@ -264,6 +697,21 @@ public:
         {
             const auto &line = wrappedLines[topLine + i].first;
             const auto &info = wrappedLines[topLine + i].second;
+            int offset = 0;
+
+            // 标记栏: 只在原始行的第一段显示
+            if (!gutterMarks.empty())
+            {
+                int source = wrappedSource[topLine + i];
+                bool first = topLine + i == 0 || wrappedSource[topLine + i - 1] != source;
+                char mark = (first && source < (int)gutterMarks.size()) ? gutterMarks[source] : ' ';
+                int pair = mark == 'E' ? 7 : (mark == 'W' ? 6 : 3);
+                wattron(win, COLOR_PAIR(pair) | A_BOLD);
+                mvwaddch(win, i, 0, mark);
+                wattroff(win, COLOR_PAIR(pair) | A_BOLD);
+                waddch(win, ' ');
+                offset = 2;
+            }
 
             for (size_t j = 0; j < line.length(); ++j)
             {
@@ -311,10 +759,10 @@ public:
                 }
             }
             // waddch(win, '\n');
-            int remaining = winWidth - line.length();
+            int remaining = winWidth - offset - line.length();
             if (remaining > 0)
             {
-                wmove(win, i, line.length());
+                wmove(win, i, offset + line.length());
                 for (int k = 0; k < remaining; ++k)
                 {
                     waddch(win, ' ');
@@ -386,6 +834,7 @@ public:
         werase(win);
         topLine = 0;
         filename = newFile;
+        gutterMarks.clear();
         return reloadFile();
     }
 };
@@ -1172,764 +1621,5598 @@ std::string editorChoice()
     // 返回编辑器名称
 }
 
-// 调用asciinema记录编辑器
-/**
- * editor: 编辑器
- * filename: 文件名
- * recordFile: 记录文件名
- */
-void record_with_asciinema(const std::string &editor,
-                           const std::string &filename,
-                           const std::string &recording_file)
+// 会话私有的运行时目录
+// 位于 $XDG_RUNTIME_DIR(通常为 /run/user/<uid>)下, 没有时退回 /tmp;
+// mkdtemp 以0700权限创建, 同一服务器上的多个会话互不干扰, 退出时删除
+const std::filesystem::path &session_runtime_dir()
 {
-    // Save current ncurses state
-    def_prog_mode();
-    // End ncurses mode and return to normal terminal mode
-    endwin();
+    static std::once_flag once;
+    static std::filesystem::path dir;
+    std::call_once(once, []()
+                   {
+                       const char *runtime = std::getenv("XDG_RUNTIME_DIR");
+                       std::error_code ec;
+                       std::filesystem::path base = (runtime && std::filesystem::is_directory(runtime, ec))
+                                                        ? runtime
+                                                        : "/tmp";
+                       std::string pattern = (base / "shell-lab-XXXXXX").string();
+                       if (mkdtemp(pattern.data()))
+                           dir = pattern;
+                   });
+    return dir;
+}
 
-    // Construct the command string
-    std::string command = editor + " " + filename;
+void remove_session_runtime_dir()
+{
+    std::error_code ec;
+    if (!session_runtime_dir().empty())
+        std::filesystem::remove_all(session_runtime_dir(), ec);
+}
 
-    // Fork a child process
-    pid_t pid = fork();
-    if (pid == -1)
-    {
-        // Fork failed
-        reset_prog_mode();
-        refresh();
-        throw std::runtime_error("Failed to fork process");
-    }
-    else if (pid == 0)
-    {
-        if (file.tellg() == 0)
-        {
-            execlp("asciinema",
-                   "asciinema",
-                   "rec",
-                   "-q",
-                   "--stdin",
-                   "--command",
-                   command.c_str(),
-                   recording_file.c_str(),
-                   nullptr);
+// 同一目录下多个会话写临时文件时用pid区分
+std::filesystem::path temp_sibling(const std::filesystem::path &path)
+{
+    return path.string() + "." + std::to_string(getpid()) + ".tmp";
+}
 
-            // If execlp returns, it failed
-            exit(EXIT_FAILURE);
-        }
-        // Child process - execute asciinema
-        else
-        {
-            execlp("asciinema",
-                   "asciinema",
-                   "rec",
-                   "-q",
-                   "--stdin",
-                   "--append",
-                   "--command",
-                   command.c_str(),
-                   recording_file.c_str(),
-                   nullptr);
+// 录像分段存储
+// 每次编辑会话单独录制为一个 zstd 压缩分段, 旧分段提交后不再变化,
+// manifest.json 记录分段顺序与元数据
+#define CAST_ZSTD_LEVEL 9
 
-            // If execlp returns, it failed
-            exit(EXIT_FAILURE);
-        }
+// 分段目录: lab1/lab1.cast -> lab1/lab1.cast.d/
+std::filesystem::path cast_segment_dir(const std::filesystem::path &recording_file)
+{
+    return recording_file.string() + ".d";
+}
+
+// 原子写入json(先写临时文件再rename)
+bool save_json_atomic(const std::filesystem::path &path, const nlohmann::json &data)
+{
+    std::filesystem::path tmp = temp_sibling(path);
+    std::ofstream out(tmp, std::ios::trunc);
+    if (!out.is_open())
+    {
+        return false;
     }
-    else
+    out << data.dump(4);
+    out.close();
+    if (!out)
     {
-        // Parent process - wait for child to complete
-        int status;
-        waitpid(pid, &status, 0);
-
-        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
-        {
-            reset_prog_mode();
-            refresh();
-            throw std::runtime_error("asciinema recording failed");
-        }
+        return false;
     }
-
-    initscr();
-
-    // Restore ncurses state
-    reset_prog_mode();
-    // Reinitialize ncurses
-    refresh();
+    std::error_code ec;
+    std::filesystem::rename(tmp, path, ec);
+    return !ec;
 }
 
-void runShellCheck(const std::string &scriptPath)
+// 读取分段清单, 不存在时返回空清单
+nlohmann::json load_cast_manifest(const std::filesystem::path &segment_dir)
 {
-    // 构建ShellCheck命令
-    std::string command = "shellcheck " + scriptPath + " > " + CHECK_PATH + " 2>&1";
-
-    // 执行命令
-    system(command.c_str());
+    // 新建还是追加只取决于清单是否存在
+    struct stat st;
+    std::filesystem::path path = segment_dir / "manifest.json";
+    nlohmann::json manifest = nlohmann::json::object();
+    if (stat(path.c_str(), &st) == 0)
+    {
+        std::ifstream in(path);
+        manifest = nlohmann::json::parse(in, nullptr, false);
+    }
+    if (manifest.is_discarded() || !manifest.is_object())
+    {
+        manifest = nlohmann::json::object();
+    }
+    if (!manifest.contains("segments"))
+    {
+        manifest["version"] = 1;
+        manifest["compression"] = "zstd";
+        manifest["segments"] = nlohmann::json::array();
+    }
+    return manifest;
 }
 
-// git操作函数
-
-// git init
-bool git_init_with_config(const std::string &working_dir,
-                          const std::string &user_name,
-                          const std::string &user_email,
-                          bool global_config = false)
+// 流式压缩一个原始录像文件, 同时从最后一个事件取得时长
+bool compress_cast_segment(const std::filesystem::path &raw_file,
+                           const std::filesystem::path &zst_file,
+                           nlohmann::json &info)
 {
-    // // 初始化libgit2库
-    // if (git_libgit2_init() < 0)
-    // {
-    //     const git_error *e = giterr_last();
-    //     std::cerr << "Failed to initialize libgit2: "
-    //               << (e ? e->message : "Unknown error") << '\n';
-    //     return false;
-    // }
+    std::ifstream in(raw_file, std::ios::binary);
+    std::ofstream out(zst_file, std::ios::binary | std::ios::trunc);
+    if (!in.is_open() || !out.is_open())
+    {
+        return false;
+    }
 
-    // 初始化Git仓库
-    git_repository *repo = nullptr;
-    int result = git_repository_init(&repo, working_dir.c_str(), 0);
+    ZSTD_CCtx *cctx = ZSTD_createCCtx();
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, CAST_ZSTD_LEVEL);
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1);
 
-    if (result >= 0)
+    std::vector<char> inBuf(ZSTD_CStreamInSize());
+    std::vector<char> outBuf(ZSTD_CStreamOutSize());
+    std::string lastLine, pending;
+    size_t rawBytes = 0, zstBytes = 0;
+    bool ok = true;
+
+    while (ok)
     {
-        // 打开配置（仓库级或全局）
-        git_config *cfg = nullptr;
-        if (global_config ? git_config_open_default(&cfg) >= 0
-                          : git_repository_config(&cfg, repo) >= 0)
+        in.read(inBuf.data(), inBuf.size());
+        size_t readSize = in.gcount();
+        bool lastChunk = readSize < inBuf.size();
+        rawBytes += readSize;
+
+        // 只保留最后一行, 用于计算时长
+        pending.append(inBuf.data(), readSize);
+        size_t cut = pending.rfind('\n', pending.size() >= 2 ? pending.size() - 2 : 0);
+        if (cut != std::string::npos)
         {
-            // 设置用户名称
-            if (git_config_set_string(cfg, "user.name", user_name.c_str()) < 0)
-            {
-                const git_error *e = giterr_last();
-                std::cerr << "Failed to set user.name: "
-                          << (e ? e->message : "Unknown error") << '\n';
-                result = -1;
-            }
+            pending.erase(0, cut + 1);
+        }
 
-            // 设置用户邮箱
-            if (result >= 0 && git_config_set_string(cfg, "user.email", user_email.c_str()) < 0)
+        ZSTD_EndDirective mode = lastChunk ? ZSTD_e_end : ZSTD_e_continue;
+        ZSTD_inBuffer input = {inBuf.data(), readSize, 0};
+        bool finished = false;
+        while (!finished)
+        {
+            ZSTD_outBuffer output = {outBuf.data(), outBuf.size(), 0};
+            size_t remaining = ZSTD_compressStream2(cctx, &output, &input, mode);
+            if (ZSTD_isError(remaining))
             {
-                const git_error *e = giterr_last();
-                std::cerr << "Failed to set user.email: "
-                          << (e ? e->message : "Unknown error") << '\n';
-                result = -1;
+                ok = false;
+                break;
             }
-
-            git_config_free(cfg);
+            out.write(outBuf.data(), output.pos);
+            zstBytes += output.pos;
+            finished = lastChunk ? (remaining == 0) : (input.pos == input.size);
         }
-        else
+        if (lastChunk)
         {
-            const git_error *e = giterr_last();
-            std::cerr << "Failed to open config: "
-                      << (e ? e->message : "Unknown error") << '\n';
-            result = -1;
+            break;
         }
     }
+    ZSTD_freeCCtx(cctx);
+    out.close();
+    ok = ok && out;
 
-    // 清理资源
-    if (repo)
-        git_repository_free(repo);
-    //git_libgit2_shutdown();
-
-    // 处理结果
-    if (result < 0)
+    // 最后一个事件形如 [12.345, "o", "..."]
+    lastLine = pending;
+    while (!lastLine.empty() && (lastLine.back() == '\n' || lastLine.back() == '\r'))
     {
-        return false;
+        lastLine.pop_back();
+    }
+    double duration = 0;
+    nlohmann::json event = nlohmann::json::parse(lastLine, nullptr, false);
+    if (!event.is_discarded() && event.is_array() && !event.empty() && event[0].is_number())
+    {
+        duration = event[0];
     }
 
-    // std::cout << "Initialized empty Git repository in " << working_dir << '\n';
-    // std::cout << "Configured user.name = " << user_name
-    //           << (global_config ? " (global)" : "") << '\n';
-    // std::cout << "Configured user.email = " << user_email
-    //           << (global_config ? " (global)" : "") << '\n';
-    return true;
+    info["raw_bytes"] = rawBytes;
+    info["bytes"] = zstBytes;
+    info["duration"] = duration;
+    return ok;
 }
 
-// git add
-bool git_add_all(const std::string &repo_path)
+// 会话原始录像的位置, 压缩后才进入仓库
+// 没有会话私有目录时放在系统临时目录, 不能留在实验目录里被 git_add_all 提交
+std::filesystem::path cast_raw_file()
 {
-    // // 初始化libgit2库
-    // if (git_libgit2_init() < 0)
-    // {
-    //     const git_error *e = giterr_last();
-    //     std::cerr << "Failed to initialize libgit2: "
-    //               << (e ? e->message : "Unknown error") << '\n';
-    //     return false;
-    // }
-
-    git_repository *repo = nullptr;
-    git_index *index = nullptr;
-    int result = 0;
-
-    // 打开仓库
-    if (git_repository_open(&repo, repo_path.c_str()) < 0)
+    if (!session_runtime_dir().empty())
     {
-        const git_error *e = giterr_last();
-        std::cerr << "Failed to open repository: "
-                  << (e ? e->message : "Unknown error") << '\n';
-        result = -1;
-        goto cleanup;
+        return session_runtime_dir() / "session.cast";
     }
+    return std::filesystem::temp_directory_path() / ("shell-lab-" + std::to_string(getpid()) + ".cast");
+}
 
-    // 获取仓库索引
-    if (git_repository_index(&index, repo) < 0)
+// 把一次会话的原始录像压缩为新分段并登记到清单
+// 失败时同样删除原始录像
+bool store_cast_segment(const std::filesystem::path &raw_file,
+                        const std::filesystem::path &segment_dir,
+                        std::time_t started)
+{
+    TRACE_SPAN("store_cast_segment", "file");
+    std::error_code ec;
+    if (!std::filesystem::exists(raw_file, ec) || std::filesystem::file_size(raw_file, ec) == 0)
     {
-        const git_error *e = giterr_last();
-        std::cerr << "Failed to get repository index: "
-                  << (e ? e->message : "Unknown error") << '\n';
-        result = -1;
-        goto cleanup;
+        std::filesystem::remove(raw_file, ec);
+        return false;
     }
 
-    // 添加所有工作目录更改到索引
-    if (git_index_add_all(index, nullptr, 0, nullptr, nullptr) < 0)
+    nlohmann::json manifest = load_cast_manifest(segment_dir);
+    char name[32];
+    snprintf(name, sizeof(name), "%06zu.cast.zst", manifest["segments"].size() + 1);
+
+    nlohmann::json info;
+    info["file"] = name;
+    info["started"] = started;
+    bool ok = compress_cast_segment(raw_file, segment_dir / name, info);
+    if (ok)
     {
-        const git_error *e = giterr_last();
-        std::cerr << "Failed to add files to index: "
-                  << (e ? e->message : "Unknown error") << '\n';
-        result = -1;
-        goto cleanup;
+        manifest["segments"].push_back(info);
+        ok = save_json_atomic(segment_dir / "manifest.json", manifest);
     }
-
-    // 写入索引到磁盘
-    if (git_index_write(index) < 0)
+    if (!ok)
     {
-        const git_error *e = giterr_last();
-        std::cerr << "Failed to write index: "
-                  << (e ? e->message : "Unknown error") << '\n';
-        result = -1;
-        goto cleanup;
+        std::filesystem::remove(segment_dir / name, ec);
     }
+    std::filesystem::remove(raw_file, ec);
+    return ok;
+}
 
-    // std::cout << "Added all changes to the staging area.\n";
-
-cleanup:
-    // 清理资源
-    if (index)
-        git_index_free(index);
-    if (repo)
-        git_repository_free(repo);
-    //git_libgit2_shutdown();
+// 流式解压一个录像分段到内存
+bool decompress_cast_segment(const std::filesystem::path &zst_file, std::string &out)
+{
+    std::ifstream in(zst_file, std::ios::binary);
+    if (!in.is_open())
+    {
+        return false;
+    }
 
-    return result == 0;
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    std::vector<char> inBuf(ZSTD_DStreamInSize());
+    std::vector<char> outBuf(ZSTD_DStreamOutSize());
+    size_t remaining = 1;
+    bool ok = true;
+    out.clear();
+    while (ok && in)
+    {
+        in.read(inBuf.data(), inBuf.size());
+        ZSTD_inBuffer input = {inBuf.data(), (size_t)in.gcount(), 0};
+        ZSTD_outBuffer output;
+        do
+        {
+            output = {outBuf.data(), outBuf.size(), 0};
+            remaining = ZSTD_decompressStream(dctx, &output, &input);
+            if (ZSTD_isError(remaining))
+            {
+                ok = false;
+                break;
+            }
+            out.append(outBuf.data(), output.pos);
+        } while (input.pos < input.size || output.pos == output.size);
+    }
+    ZSTD_freeDCtx(dctx);
+    return ok && remaining == 0;
 }
 
-// git commit
-bool use_git_commit(const std::string &repo_path, const std::string &message)
+// 未分段的旧录像(asciinema --append 写入的 labN.cast)的时长: 只读文件末尾
+double cast_file_duration(const std::filesystem::path &cast_file)
 {
-    // 初始化libgit2库
-    //git_libgit2_init();
+    std::ifstream in(cast_file, std::ios::binary | std::ios::ate);
+    if (!in.is_open())
+    {
+        return 0;
+    }
+    std::streamoff size = in.tellg();
+    std::streamoff tail = std::min<std::streamoff>(size, 1 << 20);
+    std::string buffer(tail, '\0');
+    in.seekg(size - tail);
+    in.read(&buffer[0], tail);
+    // 最后一个事件行以 "[时间," 开头
+    size_t line = buffer.rfind("\n[");
+    return line == std::string::npos ? 0 : std::strtod(buffer.c_str() + line + 2, nullptr);
+}
 
-    // 声明所有需要释放的资源
-    git_repository *repo = nullptr;
-    git_index *index = nullptr;
-    git_signature *signature = nullptr;
-    git_tree *tree = nullptr;
-    git_commit *parent_commit = nullptr;
-    bool success = false;
+// 录像行为统计
+// 逐行流式读取事件, 内存占用与录像长度无关
+#define CAST_IDLE_GAP_SECONDS 30 // 事件间隔超过此值视为离开, 不计入活跃时间
+#define CAST_PASTE_MIN_CHARS 16  // 一次输入事件达到此按键数视为粘贴
+#define CAST_PASTE_JOIN_SECONDS 1 // 间隔小于此值的连续粘贴事件算同一次粘贴
+#define CAST_STATS_VERSION 2      // 统计方法改变时加一, 旧的统计结果重新计算
 
-    try
+// 逐行读取录像(zstd 分段边解压边切行)
+bool for_each_cast_line(const std::filesystem::path &cast_file, bool compressed,
+                        const std::function<void(const std::string &)> &onLine)
+{
+    std::ifstream in(cast_file, std::ios::binary);
+    if (!in.is_open())
     {
-        // 1. 打开Git仓库
-        if (git_repository_open(&repo, repo_path.c_str()) < 0)
+        return false;
+    }
+    if (!compressed)
+    {
+        std::string line;
+        while (std::getline(in, line))
         {
-            throw std::runtime_error("无法打开仓库: " + std::string(giterr_last()->message));
+            onLine(line);
         }
+        return true;
+    }
 
-        // 2. 获取并刷新索引
-        if (git_repository_index(&index, repo) < 0)
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    std::vector<char> inBuf(ZSTD_DStreamInSize());
+    std::vector<char> outBuf(ZSTD_DStreamOutSize());
+    std::string pending;
+    size_t remaining = 1;
+    bool ok = true;
+    while (ok && in)
+    {
+        in.read(inBuf.data(), inBuf.size());
+        ZSTD_inBuffer input = {inBuf.data(), (size_t)in.gcount(), 0};
+        ZSTD_outBuffer output;
+        do
         {
-            throw std::runtime_error("无法获取索引: " + std::string(giterr_last()->message));
-        }
-        if (git_index_read(index, 1) < 0)
-        { // 强制刷新索引
-            throw std::runtime_error("无法刷新索引: " + std::string(giterr_last()->message));
-        }
+            output = {outBuf.data(), outBuf.size(), 0};
+            remaining = ZSTD_decompressStream(dctx, &output, &input);
+            if (ZSTD_isError(remaining))
+            {
+                ok = false;
+                break;
+            }
+            pending.append(outBuf.data(), output.pos);
+            size_t start = 0, end;
+            while ((end = pending.find('\n', start)) != std::string::npos)
+            {
+                onLine(pending.substr(start, end - start));
+                start = end + 1;
+            }
+            pending.erase(0, start);
+        } while (input.pos < input.size || output.pos == output.size);
+    }
+    ZSTD_freeDCtx(dctx);
+    if (ok && !pending.empty())
+    {
+        onLine(pending);
+    }
+    return ok && remaining == 0;
+}
 
-        // 3. 检查是否有待提交的更改
-        if (git_index_entrycount(index) == 0)
+struct castStats
+{
+    double duration = 0;
+    double active = 0;      // 去掉长时间空闲后的时长
+    double longestIdle = 0;
+    size_t idleGaps = 0;
+    size_t keystrokes = 0;
+    size_t pasteBursts = 0;
+    size_t pastedChars = 0;
+    size_t outputBytes = 0;
+    double lastTime = 0;
+    double lastPaste = -1; // 上一个粘贴事件的时间
+
+    // 一个输入事件中的按键数: 面板编辑时一个事件包含两次轮询之间的所有按键,
+    // 方向键等转义序列算一次按键, 多字节UTF-8字符算一次按键
+    static size_t countKeys(const std::string &payload)
+    {
+        size_t keys = 0;
+        for (size_t i = 0; i < payload.size(); ++keys)
         {
-            throw std::runtime_error("没有待提交的更改");
+            unsigned char c = payload[i++];
+            if (c == 0x1b && i < payload.size())
+            {
+                unsigned char next = payload[i++];
+                if (next == '[')
+                {
+                    // CSI: 参数字节之后以 0x40-0x7E 结束
+                    while (i < payload.size() && ((unsigned char)payload[i] < 0x40 || (unsigned char)payload[i] > 0x7E))
+                        i++;
+                    i++;
+                }
+                else if (next == 'O')
+                {
+                    i++; // SS3: 应用光标模式下的方向键等
+                }
+            }
+            else
+            {
+                while (i < payload.size() && (payload[i] & 0xC0) == 0x80)
+                    i++;
+            }
         }
+        return keys;
+    }
 
-        // 4. 创建树对象
-        git_oid tree_id;
-        if (git_index_write_tree(&tree_id, index) < 0)
+    void add(double time, const std::string &type, const std::string &payload)
+    {
+        double gap = time - lastTime;
+        if (gap >= CAST_IDLE_GAP_SECONDS)
         {
-            throw std::runtime_error("无法写入树对象: " + std::string(giterr_last()->message));
+            idleGaps++;
+            longestIdle = std::max(longestIdle, gap);
         }
-        if (git_tree_lookup(&tree, repo, &tree_id) < 0)
+        else if (gap > 0)
         {
-            throw std::runtime_error("无法查找树对象: " + std::string(giterr_last()->message));
+            active += gap;
         }
+        lastTime = std::max(lastTime, time);
+        duration = lastTime;
 
-        // 5. 获取父提交(如果不是首次提交)
-        git_oid parent_id;
-        const git_commit *parents[1] = {nullptr};
-        int parent_count = 0;
-
-        if (git_reference_name_to_id(&parent_id, repo, "HEAD") == 0)
+        if (type == "o")
         {
-            if (git_commit_lookup(&parent_commit, repo, &parent_id) < 0)
+            outputBytes += payload.size();
+        }
+        else if (type == "i")
+        {
+            // 按键数达到阈值才视为粘贴, 大段粘贴可能分成几个事件
+            size_t keys = countKeys(payload);
+            if (keys >= CAST_PASTE_MIN_CHARS)
             {
-                throw std::runtime_error("无法查找父提交: " + std::string(giterr_last()->message));
+                if (lastPaste < 0 || time - lastPaste >= CAST_PASTE_JOIN_SECONDS)
+                    pasteBursts++;
+                pastedChars += keys;
+                lastPaste = time;
+            }
+            else
+            {
+                keystrokes += keys;
             }
-            parents[0] = parent_commit;
-            parent_count = 1;
         }
+    }
 
-        // 6. 创建签名(带多重回退机制)
-        if (git_signature_default(&signature, repo) < 0)
-        {
-            // 尝试从环境变量获取
-            const char *name = std::getenv("GIT_AUTHOR_NAME");
-            const char *email = std::getenv("GIT_AUTHOR_EMAIL");
-            if (!name || !email || git_signature_now(&signature, name, email) < 0)
-            {
-                // 最终回退方案
-                if (git_signature_now(&signature, "Git User", "user@example.com") < 0)
-                {
-                    throw std::runtime_error("无法创建签名: " + std::string(giterr_last()->message));
-                }
-            }
-        }
+    nlohmann::json toJson() const
+    {
+        nlohmann::json summary;
+        summary["duration"] = std::round(duration * 10) / 10;
+        summary["active"] = std::round(active * 10) / 10;
+        summary["idle_gaps"] = idleGaps;
+        summary["longest_idle"] = std::round(longestIdle * 10) / 10;
+        summary["keystrokes"] = keystrokes;
+        summary["keys_per_min"] = active > 0 ? std::round(keystrokes * 600 / active) / 10 : 0;
+        summary["paste_bursts"] = pasteBursts;
+        summary["pasted_chars"] = pastedChars;
+        summary["output_bytes"] = outputBytes;
+        return summary;
+    }
+};
 
-        // 7. 创建提交
-        git_oid commit_id;
-        if (git_commit_create(
-                &commit_id,
-                repo,
-                "HEAD",
-                signature,
-                signature,
-                "UTF-8",
-                message.c_str(),
-                tree,
-                parent_count,
-                parent_count ? parents : nullptr) < 0)
+bool analyze_cast(const std::filesystem::path &cast_file, bool compressed, castStats &stats)
+{
+    bool header = true;
+    return for_each_cast_line(cast_file, compressed, [&](const std::string &line)
+                              {
+        if (header)
         {
-            throw std::runtime_error("无法创建提交: " + std::string(giterr_last()->message));
+            header = false;
+            return;
         }
+        nlohmann::json event = nlohmann::json::parse(line, nullptr, false);
+        if (!event.is_discarded() && event.is_array() && event.size() >= 3 &&
+            event[0].is_number() && event[1].is_string() && event[2].is_string())
+        {
+            stats.add(event[0], event[1], event[2]);
+        } });
+}
 
-        // std::cout << "提交成功: " << git_oid_tostr_s(&commit_id) << std::endl;
-        success = true;
+// 更新一个实验的会话统计, 已统计过的分段(内容不再变化)直接沿用
+/**
+ * recording_file: 记录文件名(labN/labN.cast)
+ * sessions: student.json 中对应的 labN 数组
+ * 返回是否有新的统计
+ */
+bool update_cast_summaries(const std::filesystem::path &recording_file, nlohmann::json &sessions)
+{
+    std::unordered_map<std::string, nlohmann::json> known;
+    if (sessions.is_array())
+    {
+        for (const auto &entry : sessions)
+            if (entry.is_object() && entry.contains("segment") && entry["segment"].is_string())
+                known[entry["segment"]] = entry;
     }
-    catch (const std::exception &e)
+
+    std::vector<std::pair<std::string, std::filesystem::path>> sources;
+    std::error_code ec;
+    if (std::filesystem::exists(recording_file, ec))
+        sources.push_back({recording_file.filename().string(), recording_file});
+    std::filesystem::path segment_dir = cast_segment_dir(recording_file);
+    nlohmann::json manifest = load_cast_manifest(segment_dir);
+    for (const auto &info : manifest["segments"])
+        if (info.contains("file") && info["file"].is_string())
+            sources.push_back({info["file"], segment_dir / info["file"].get<std::string>()});
+
+    bool changed = false;
+    nlohmann::json updated = nlohmann::json::array();
+    for (const auto &source : sources)
     {
-        std::cerr << "错误: " << e.what() << std::endl;
-        if (const git_error *err = giterr_last())
+        bool legacy = source.second == recording_file;
+        size_t bytes = std::filesystem::file_size(source.second, ec);
+        auto found = known.find(source.first);
+        if (found != known.end() && found->second.value("bytes", (size_t)0) == bytes &&
+            found->second.value("version", 1) == CAST_STATS_VERSION)
         {
-            std::cerr << "Git错误详情: " << err->message << std::endl;
+            updated.push_back(found->second);
+            continue;
         }
+        castStats stats;
+        if (!analyze_cast(source.second, !legacy, stats))
+            continue;
+        nlohmann::json summary = stats.toJson();
+        summary["segment"] = source.first;
+        summary["bytes"] = bytes;
+        summary["version"] = CAST_STATS_VERSION;
+        updated.push_back(summary);
+        changed = true;
     }
+    changed = changed || updated.size() != known.size();
+    sessions = updated;
+    return changed;
+}
 
-    // 释放所有资源
-    if (signature)
-        git_signature_free(signature);
-    if (tree)
-        git_tree_free(tree);
-    if (parent_commit)
-        git_commit_free(parent_commit);
-    if (index)
-        git_index_free(index);
-    if (repo)
-        git_repository_free(repo);
-
-    //git_libgit2_shutdown();
-    return success;
+// student.json 中 lab_dir(以及可选的 lab_sh)必须是字符串数组
+// 统计、批处理和评分在线程中读取这些字段, 类型错误抛出的异常会结束整个进程
+bool student_labs_valid(const nlohmann::json &student)
+{
+    auto strings = [&](const char *key)
+    {
+        return student[key].is_array() &&
+               std::all_of(student[key].begin(), student[key].end(), [](const nlohmann::json &item)
+                           { return item.is_string(); });
+    };
+    return student.is_object() && student.contains("lab_dir") && strings("lab_dir") &&
+           (!student.contains("lab_sh") || strings("lab_sh"));
 }
 
-// git remote
-bool git_remote_add_origin(const std::string &repo_path, const std::string &url)
+// 更新一个学生仓库中所有实验的统计并写回 student.json
+bool update_student_summaries(const std::filesystem::path &workDir, const std::vector<std::string> &labs = {})
 {
-    // // 初始化libgit2库
-    // if (git_libgit2_init() < 0)
-    // {
-    //     const git_error *e = giterr_last();
-    //     std::cerr << "Failed to initialize libgit2: "
-    //               << (e ? e->message : "Unknown error") << '\n';
-    //     return false;
-    // }
+    std::ifstream in(workDir / "student.json");
+    nlohmann::json student = nlohmann::json::parse(in, nullptr, false);
+    in.close();
+    if (student.is_discarded() || !student_labs_valid(student))
+    {
+        return false;
+    }
+    bool changed = false;
+    for (const auto &item : student["lab_dir"])
+    {
+        std::string lab = item;
+        if (!labs.empty() && std::find(labs.begin(), labs.end(), lab) == labs.end())
+            continue;
+        changed = update_cast_summaries(workDir / lab / (lab + ".cast"), student[lab]) || changed;
+    }
+    return !changed || save_json_atomic(workDir / "student.json", student);
+}
 
-    git_repository *repo = nullptr;
-    git_remote *remote = nullptr;
-    int result = 0;
+// --analyze: 并行统计整个班级的录像
+int analyze_class(const std::vector<std::string> &dirs)
+{
+    std::atomic<size_t> next(0);
+    std::mutex outputMutex;
+    int failed = 0;
+    auto worker = [&]()
+    {
+        size_t i;
+        while ((i = next++) < dirs.size())
+        {
+            bool ok = update_student_summaries(dirs[i]);
+            std::lock_guard<std::mutex> lock(outputMutex);
+            std::cout << (ok ? "ok     " : "failed ") << dirs[i] << std::endl;
+            failed += ok ? 0 : 1;
+        }
+    };
+    size_t count = std::min<size_t>(dirs.size(), std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < count; ++i)
+        threads.emplace_back(worker);
+    for (auto &thread : threads)
+        thread.join();
+    return failed == 0 ? 0 : 1;
+}
 
-    // 打开仓库
-    if (git_repository_open(&repo, repo_path.c_str()) < 0)
+// asciicast v2 录像写入
+// 事件先写入内存缓冲, 超过 CAST_FLUSH_BYTES 或距上次写盘超过 CAST_FLUSH_MS 时才写文件
+#define CAST_FLUSH_BYTES 65536
+#define CAST_FLUSH_MS 1000
+class castWriter
+{
+private:
+    int fd;
+    std::string buffer;
+    std::string pendingOutput; // 被read截断的UTF-8多字节字符
+    std::string pendingInput;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point lastFlush;
+
+    // 返回以完整UTF-8字符结尾的前缀长度
+    static size_t completeUtf8(const std::string &data)
     {
-        const git_error *e = giterr_last();
-        std::cerr << "Failed to open repository: "
-                  << (e ? e->message : "Unknown error") << '\n';
-        result = -1;
-        goto cleanup;
+        size_t n = data.size();
+        for (size_t back = 1; back <= 3 && back <= n; ++back)
+        {
+            unsigned char c = data[n - back];
+            if ((c & 0xC0) == 0x80)
+                continue; // 后续字节
+            size_t need = (c & 0xE0) == 0xC0 ? 2 : (c & 0xF0) == 0xE0 ? 3 : (c & 0xF8) == 0xF0 ? 4 : 1;
+            return need > back ? n - back : n;
+        }
+        return n;
     }
 
-    // 检查是否已存在名为"origin"的远程
-    if (git_remote_lookup(&remote, repo, "origin") == 0)
+public:
+    castWriter()
+        : fd(-1)
     {
-        std::cerr << "Remote 'origin' already exists\n";
-        git_remote_free(remote);
-        result = -1;
-        goto cleanup;
     }
 
-    // 创建新的远程
-    if (git_remote_create(&remote, repo, "origin", url.c_str()) < 0)
+    ~castWriter()
     {
-        const git_error *e = giterr_last();
-        std::cerr << "Failed to create remote: "
-                  << (e ? e->message : "Unknown error") << '\n';
-        result = -1;
-        goto cleanup;
+        close();
     }
 
-    // std::cout << "Added remote 'origin' with URL: " << url << '\n';
+    bool open(const std::filesystem::path &path, int width, int height)
+    {
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        if (fd < 0)
+            return false;
+        start = lastFlush = std::chrono::steady_clock::now();
+
+        nlohmann::json header;
+        header["version"] = 2;
+        header["width"] = width;
+        header["height"] = height;
+        header["timestamp"] = std::time(nullptr);
+        const char *term = std::getenv("TERM");
+        const char *shell = std::getenv("SHELL");
+        header["env"] = {{"TERM", term ? term : ""}, {"SHELL", shell ? shell : ""}};
+        buffer = header.dump() + "\n";
+        return true;
+    }
 
-cleanup:
-    // 清理资源
-    if (remote)
-        git_remote_free(remote);
-    if (repo)
-        git_repository_free(repo);
-    //git_libgit2_shutdown();
+    // 距开始的秒数(单调时钟)
+    double elapsed() const
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
 
-    return result == 0;
-}
+    // type: 'o' 输出, 'i' 输入, 'r' 窗口大小变化
+    void event(char type, const char *data, size_t len)
+    {
+        std::string &pending = type == 'i' ? pendingInput : pendingOutput;
+        pending.append(data, len);
+        size_t complete = type == 'r' ? pending.size() : completeUtf8(pending);
+        if (complete == 0)
+            return;
+
+        char time[32];
+        snprintf(time, sizeof(time), "%.6f", elapsed());
+        nlohmann::json text = pending.substr(0, complete);
+        pending.erase(0, complete);
+        buffer += std::string("[") + time + ", \"" + type + "\", " +
+                  text.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace) + "]\n";
+        flushIfDue();
+    }
 
-// git 远程操作
-//  错误处理函数
-void check_error(int error_code, const char *action)
-{
-    if (error_code < 0)
+    void flushIfDue()
     {
-        const git_error *error = giterr_last();
-        std::cerr << "Error (" << error_code << ") during " << action << ": "
-                  << (error ? error->message : "Unknown error") << std::endl;
-        exit(1);
+        auto now = std::chrono::steady_clock::now();
+        if (buffer.size() >= CAST_FLUSH_BYTES ||
+            (!buffer.empty() && now - lastFlush >= std::chrono::milliseconds(CAST_FLUSH_MS)))
+            flush();
     }
-}
 
-// SSH 认证回调函数
-int credentials_callback(git_cred **cred, const char *url, const char *username_from_url,
-                         unsigned int allowed_types, void *payload)
-{
-    (void)url;
-    (void)username_from_url;
-    (void)payload;
+    void flush()
+    {
+        size_t done = 0;
+        while (fd >= 0 && done < buffer.size())
+        {
+            ssize_t n = write(fd, buffer.data() + done, buffer.size() - done);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            done += n;
+        }
+        buffer.clear();
+        lastFlush = std::chrono::steady_clock::now();
+    }
 
-    // 只处理 SSH 代理方式
-    if (allowed_types & GIT_CREDENTIAL_SSH_KEY)
+    void close()
     {
-        return git_cred_ssh_key_from_agent(cred, username_from_url);
+        if (fd < 0)
+            return;
+        flush();
+        ::close(fd);
+        fd = -1;
     }
+};
 
-    std::cerr << "Unsupported credential type" << std::endl;
-    return -1;
+// 编辑器名称对应的可执行文件
+std::string editor_command(const std::string &editor)
+{
+    return editor == "neovim" ? "nvim" : editor;
 }
 
-// git push
-int use_git_push(const std::string &repo_path, const std::string &url)
+// 在伪终端中运行编辑器并录制
+/**
+ * editor: 编辑器
+ * filename: 文件名
+ * recordFile: 记录文件名(实际写入 recordFile.d/ 下的压缩分段)
+ */
+void record_session(const std::string &editor,
+                    const std::string &filename,
+                    const std::string &recording_file)
 {
-    //git_libgit2_init();
+    TRACE_SPAN("editor", "child");
+    // Each session is recorded into its own raw file, then compressed
+    // into a new segment so earlier segments never change.
+    std::filesystem::path segment_dir = cast_segment_dir(recording_file);
+    std::filesystem::create_directories(segment_dir);
+    std::filesystem::path raw_file = cast_raw_file();
+    std::time_t started = std::time(nullptr);
 
-    git_repository *repo = nullptr;
-    int error = git_repository_open(&repo, repo_path.c_str());
-    check_error(error, "opening repository");
+    // Save current ncurses state
+    def_prog_mode();
+    // End ncurses mode and return to normal terminal mode
+    endwin();
 
-    // 获取或创建 remote
-    git_remote *remote = nullptr;
-    error = git_remote_lookup(&remote, repo, "origin");
-    if (error < 0)
+    struct termios original;
+    struct winsize size;
+    tcgetattr(STDIN_FILENO, &original);
+    if (ioctl(STDIN_FILENO, TIOCGWINSZ, &size) < 0)
     {
-        std::cout << "Remote 'origin' not found, creating it\n";
-        error = git_remote_create(&remote, repo, "origin", url.c_str());
-        check_error(error, "creating remote");
-        check_error(error, "saving remote config");
+        size.ws_row = LINES;
+        size.ws_col = COLS;
     }
 
-    // 设置 push 选项和回调
-    git_push_options push_options;
-    git_push_options_init(&push_options, GIT_PUSH_OPTIONS_VERSION);
+    castWriter writer;
+    if (!writer.open(raw_file, size.ws_col, size.ws_row))
+    {
+        reset_prog_mode();
+        refresh();
+        throw std::runtime_error("Failed to open recording file");
+    }
 
-    git_remote_callbacks callbacks = GIT_REMOTE_CALLBACKS_INIT;
-    callbacks.credentials = credentials_callback;
-    push_options.callbacks = callbacks;
+    // 参数在 fork 之前准备: 后台线程可能正持有 malloc 的锁, 子进程只调用 exec
+    std::string command = editor_command(editor);
+    char *const argv[] = {const_cast<char *>(command.c_str()), const_cast<char *>(filename.c_str()), nullptr};
 
-    // 设置 refspecs（本地 master 推送到远程 master）
-    const char *refspec = "refs/heads/master:refs/heads/master";
-    const git_strarray refspecs = {
-        (char **)&refspec,
-        1};
+    // Run the editor on a pty so its output can be timestamped
+    int master = -1;
+    pid_t pid = forkpty(&master, nullptr, &original, &size);
+    if (pid == -1)
+    {
+        writer.close();
+        std::filesystem::remove(raw_file);
+        reset_prog_mode();
+        refresh();
+        throw std::runtime_error("Failed to fork process");
+    }
+    else if (pid == 0)
+    {
+        execvp(argv[0], argv);
+        _exit(127);
+    }
 
-    // 执行 push（包含自动连接）
-    error = git_remote_push(remote, &refspecs, &push_options);
-    check_error(error, "pushing to remote");
+    // Parent process - relay stdin/pty until the editor exits
+    struct termios raw = original;
+    cfmakeraw(&raw);
+    tcsetattr(STDIN_FILENO, TCSANOW, &raw);
 
-    // 设置 upstream 分支
-    git_reference *local_ref = nullptr;
-    error = git_branch_lookup(&local_ref, repo, "master", GIT_BRANCH_LOCAL);
-    check_error(error, "looking up local branch");
+    char buf[8192];
+    bool running = true;
+    while (running)
+    {
+        struct pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0}, {master, POLLIN, 0}};
+        int ready = poll(fds, 2, CAST_FLUSH_MS / 4);
+        if (ready < 0 && errno != EINTR)
+            break;
 
-    error = git_branch_set_upstream(local_ref, "origin/master");
-    check_error(error, "setting upstream branch");
+        // 终端大小变化时同步给编辑器并记录
+        struct winsize now;
+        if (ioctl(STDIN_FILENO, TIOCGWINSZ, &now) == 0 &&
+            (now.ws_col != size.ws_col || now.ws_row != size.ws_row))
+        {
+            size = now;
+            ioctl(master, TIOCSWINSZ, &size);
+            std::string resize = std::to_string(size.ws_col) + "x" + std::to_string(size.ws_row);
+            writer.event('r', resize.data(), resize.size());
+        }
 
-    // std::cout << "Successfully pushed to origin/master and set upstream" << std::endl;
+        if (ready > 0 && (fds[0].revents & POLLIN))
+        {
+            ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+            if (n > 0)
+            {
+                write(master, buf, n);
+                writer.event('i', buf, n);
+            }
+        }
+        if (ready > 0 && (fds[1].revents & (POLLIN | POLLHUP | POLLERR)))
+        {
+            ssize_t n = read(master, buf, sizeof(buf));
+            if (n > 0)
+            {
+                write(STDOUT_FILENO, buf, n);
+                writer.event('o', buf, n);
+            }
+            else if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            else
+            {
+                running = false; // EIO: 编辑器已退出
+            }
+        }
+        writer.flushIfDue();
+    }
 
-    git_reference_free(local_ref);
-    git_remote_free(remote);
-    git_repository_free(repo);
-    //git_libgit2_shutdown();
+    int status;
+    waitpid(pid, &status, 0);
+    close(master);
+    tcsetattr(STDIN_FILENO, TCSANOW, &original);
+    writer.close();
 
-    return 0;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) == 127)
+    {
+        std::filesystem::remove(raw_file);
+        reset_prog_mode();
+        refresh();
+        throw std::runtime_error("editor session failed");
+    }
+    store_cast_segment(raw_file, segment_dir, started);
+
+    initscr();
+    // Restore ncurses state
+    reset_prog_mode();
+    // Reinitialize ncurses
+    refresh();
 }
 
-// git pull
-int use_git_pull(std::string &repo_path)
+// 简易VT100/xterm终端模拟, 用于在面板中显示编辑器
+// 只实现常见编辑器用到的控制序列, 按行记录被改动的列区间以便只重绘变化部分
+#define VT_TERM "xterm"         // 面板中编辑器使用的TERM
+#define VT_COLOR_PAIR_BASE 16   // 8x8前景/背景色对从此编号开始
+#define VT_ESCDELAY_MS 25       // 面板编辑时ESC键的等待时间
+#define VT_PARAM_MAX 65535      // CSI数字参数的上限, 防止溢出
+#define VT_MAX_SIZE 1000        // 屏幕行数/列数的上限, 录像文件中的大小可能被损坏
+#define EDIT_PANE_MIN_ROWS 10   // 面板小于此大小时改为全屏编辑
+#define EDIT_PANE_MIN_COLS 40
+class vtScreen
 {
-    git_libgit2_init();
+public:
+    enum
+    {
+        ATTR_BOLD = 1,
+        ATTR_UNDERLINE = 2,
+        ATTR_REVERSE = 4
+    };
 
-    git_repository *repo = nullptr;
-    git_remote *remote = nullptr;
-    git_reference *remote_ref = nullptr;
-    git_reference *local_ref = nullptr;
-    git_annotated_commit *annotated_commit = nullptr;
-    git_tree *tree = nullptr;
-    git_signature *signature = nullptr;
-    git_commit *local_commit = nullptr;
-    git_commit *remote_commit = nullptr;
+    struct cell
+    {
+        char32_t ch;      // 0 表示宽字符的右半格
+        unsigned char fg; // 0-7
+        unsigned char bg; // 0-7
+        unsigned char attr;
+    };
 
-    int error = git_repository_open(&repo, repo_path.c_str());
-    check_error(error, "opening repository");
+private:
+    enum class parseState
+    {
+        GROUND,
+        ESCAPE,
+        CSI,
+        STRING, // OSC/DCS等, 直到BEL或ST
+        CHARSET // ESC ( 等后面的一个字节
+    };
 
-    // 获取远程
-    error = git_remote_lookup(&remote, repo, "origin");
-    check_error(error, "looking up remote 'origin'");
+    int rows;
+    int cols;
+    std::vector<cell> cells;
+    std::vector<cell> primary; // 进入备用屏幕时保存的主屏幕
+    bool alternate;
+    int cx, cy;
+    bool wrapPending;
+    int top, bottom; // 滚动区域
+    cell pen;
+    int savedX, savedY;
+    cell savedPen;
+    bool cursorShown;
+    bool appCursor;
+    char32_t lastChar;
+    std::vector<int> damageLo; // 每行被改动的最小列, 大于damageHi表示无改动
+    std::vector<int> damageHi;
+
+    parseState state;
+    std::string params;
+    bool stringEscape;
+    char32_t utf8Code;
+    int utf8Left;
+
+    cell blank() const
+    {
+        return cell{U' ', 7, pen.bg, 0};
+    }
 
-    // 设置 fetch 选项
-    git_fetch_options fetch_options = GIT_FETCH_OPTIONS_INIT;
-    git_remote_callbacks callbacks = GIT_REMOTE_CALLBACKS_INIT;
-    callbacks.credentials = credentials_callback;
-    fetch_options.callbacks = callbacks;
+    void damage(int row, int lo, int hi)
+    {
+        damageLo[row] = std::min(damageLo[row], lo);
+        damageHi[row] = std::max(damageHi[row], hi);
+    }
 
-    // 从远程获取更新
-    error = git_remote_fetch(remote, NULL, &fetch_options, "fetch");
-    check_error(error, "fetching from remote");
+    void damageAll()
+    {
+        for (int r = 0; r < rows; ++r)
+            damage(r, 0, cols - 1);
+    }
 
-    // 获取远程分支引用
-    error = git_branch_lookup(&remote_ref, repo, "origin/master", GIT_BRANCH_REMOTE);
-    check_error(error, "looking up remote branch");
+    void moveTo(int row, int col)
+    {
+        cy = std::max(0, std::min(rows - 1, row));
+        cx = std::max(0, std::min(cols - 1, col));
+        wrapPending = false;
+    }
 
-    // 获取本地当前分支引用
-    error = git_repository_head(&local_ref, repo);
-    check_error(error, "getting local branch");
+    void erase(int row, int from, int to)
+    {
+        from = std::max(0, from);
+        to = std::min(cols - 1, to);
+        for (int c = from; c <= to; ++c)
+            cells[row * cols + c] = blank();
+        if (from <= to)
+            damage(row, from, to);
+    }
 
-    // 获取注释提交
-    error = git_annotated_commit_from_ref(&annotated_commit, repo, remote_ref);
-    check_error(error, "getting annotated commit");
+    // 区域[first,last]内的行上移n行, 底部补空行
+    void scrollUp(int first, int last, int n)
+    {
+        n = std::min(n, last - first + 1);
+        std::copy(cells.begin() + (first + n) * cols, cells.begin() + (last + 1) * cols,
+                  cells.begin() + first * cols);
+        for (int r = last - n + 1; r <= last; ++r)
+            erase(r, 0, cols - 1);
+        for (int r = first; r <= last; ++r)
+            damage(r, 0, cols - 1);
+    }
 
-    // 检查是否需要合并
-    git_merge_analysis_t analysis;
-    git_merge_preference_t preference;
-    error = git_merge_analysis(&analysis, &preference, repo,
-                               (const git_annotated_commit **)&annotated_commit, 1);
-    check_error(error, "merge analysis");
+    void scrollDown(int first, int last, int n)
+    {
+        n = std::min(n, last - first + 1);
+        std::copy_backward(cells.begin() + first * cols, cells.begin() + (last + 1 - n) * cols,
+                           cells.begin() + (last + 1) * cols);
+        for (int r = first; r < first + n; ++r)
+            erase(r, 0, cols - 1);
+        for (int r = first; r <= last; ++r)
+            damage(r, 0, cols - 1);
+    }
 
-    if (!(analysis & GIT_MERGE_ANALYSIS_UP_TO_DATE))
+    void lineFeed()
     {
-        // 设置合并和检出选项
-        git_checkout_options checkout_options = GIT_CHECKOUT_OPTIONS_INIT;
-        checkout_options.checkout_strategy = GIT_CHECKOUT_SAFE | GIT_CHECKOUT_RECREATE_MISSING;
+        if (cy == bottom)
+            scrollUp(top, bottom, 1);
+        else if (cy < rows - 1)
+            cy++;
+        wrapPending = false;
+    }
 
-        git_merge_options merge_options = GIT_MERGE_OPTIONS_INIT;
+    void reverseIndex()
+    {
+        if (cy == top)
+            scrollDown(top, bottom, 1);
+        else if (cy > 0)
+            cy--;
+        wrapPending = false;
+    }
 
-        // 执行合并
-        error = git_merge(repo, (const git_annotated_commit **)&annotated_commit, 1,
-                          &merge_options, &checkout_options);
+    static int charWidth(char32_t c)
+    {
+        // 东亚宽字符和emoji占两列
+        if ((c >= 0x1100 && c <= 0x115F) || (c >= 0x2E80 && c <= 0xA4CF) || (c >= 0xAC00 && c <= 0xD7A3) ||
+            (c >= 0xF900 && c <= 0xFAFF) || (c >= 0xFE30 && c <= 0xFE4F) || (c >= 0xFF00 && c <= 0xFF60) ||
+            (c >= 0xFFE0 && c <= 0xFFE6) || (c >= 0x1F300 && c <= 0x1FAFF) || (c >= 0x20000 && c <= 0x3FFFD))
+            return 2;
+        return 1;
+    }
 
-        if (error != GIT_ECONFLICT)
+    void put(char32_t c)
+    {
+        int width = charWidth(c);
+        if (width > cols)
         {
-            check_error(error, "merging");
-
-            // 检查索引是否有未解决的冲突
-            git_index *index = nullptr;
-            error = git_repository_index(&index, repo);
-            check_error(error, "getting repository index");
+            // 只有一列时宽字符放不下, 用替换字符代替
+            c = 0xFFFD;
+            width = 1;
+        }
+        if (wrapPending || cx + width > cols)
+        {
+            cx = 0;
+            lineFeed();
+        }
+        cell value = pen;
+        value.ch = c;
+        cells[cy * cols + cx] = value;
+        if (width == 2)
+        {
+            value.ch = 0;
+            cells[cy * cols + cx + 1] = value;
+        }
+        damage(cy, cx, cx + width - 1);
+        lastChar = c;
+        if (cx + width >= cols)
+            wrapPending = true;
+        else
+            cx += width;
+    }
 
-            bool has_conflicts = git_index_has_conflicts(index);
-            git_index_free(index);
+    void control(char c)
+    {
+        switch (c)
+        {
+        case '\r':
+            cx = 0;
+            wrapPending = false;
+            break;
+        case '\n':
+        case '\v':
+        case '\f':
+            lineFeed();
+            break;
+        case '\b':
+            if (cx > 0)
+                cx--;
+            wrapPending = false;
+            break;
+        case '\t':
+            cx = std::min(cols - 1, (cx / 8 + 1) * 8);
+            wrapPending = false;
+            break;
+        case 0x1b:
+            state = parseState::ESCAPE;
+            break;
+        default:
+            break; // BEL, SO/SI 等忽略
+        }
+    }
 
-            if (!has_conflicts)
-            {
-                // 创建合并提交
-                git_oid new_commit_id;
-                error = git_signature_default(&signature, repo);
-                check_error(error, "creating signature");
+    void saveCursor()
+    {
+        savedX = cx;
+        savedY = cy;
+        savedPen = pen;
+    }
 
-                error = git_repository_index(&index, repo);
-                check_error(error, "getting repository index");
+    void restoreCursor()
+    {
+        pen = savedPen;
+        moveTo(savedY, savedX);
+    }
 
-                error = git_index_write_tree(&new_commit_id, index);
-                check_error(error, "writing tree");
-                git_index_free(index);
+    void escape(char c)
+    {
+        state = parseState::GROUND;
+        switch (c)
+        {
+        case '[':
+            params.clear();
+            state = parseState::CSI;
+            break;
+        case ']':
+        case 'P':
+        case 'X':
+        case '^':
+        case '_':
+            stringEscape = false;
+            state = parseState::STRING;
+            break;
+        case '(':
+        case ')':
+        case '*':
+        case '+':
+        case '#':
+            state = parseState::CHARSET;
+            break;
+        case '7':
+            saveCursor();
+            break;
+        case '8':
+            restoreCursor();
+            break;
+        case 'D':
+            lineFeed();
+            break;
+        case 'E':
+            cx = 0;
+            lineFeed();
+            break;
+        case 'M':
+            reverseIndex();
+            break;
+        case 'c':
+            reset();
+            break;
+        default:
+            break; // ESC = / ESC > 等键盘模式忽略
+        }
+    }
 
-                error = git_tree_lookup(&tree, repo, &new_commit_id);
-                check_error(error, "looking up tree");
+    void setMode(int mode, bool on)
+    {
+        switch (mode)
+        {
+        case 1:
+            appCursor = on;
+            break;
+        case 25:
+            cursorShown = on;
+            break;
+        case 47:
+        case 1047:
+        case 1049:
+            if (on == alternate)
+                break;
+            if (on)
+            {
+                saveCursor();
+                primary = cells;
+                std::fill(cells.begin(), cells.end(), blank());
+            }
+            else
+            {
+                cells = primary;
+                primary.clear();
+                restoreCursor();
+            }
+            alternate = on;
+            damageAll();
+            break;
+        default:
+            break;
+        }
+    }
 
-                error = git_reference_peel((git_object **)&local_commit, local_ref, GIT_OBJ_COMMIT);
-                check_error(error, "peeling local reference");
+    void selectGraphic(const std::vector<int> &p)
+    {
+        for (size_t i = 0; i < p.size(); ++i)
+        {
+            int v = p[i];
+            if (v == 0)
+                pen = cell{U' ', 7, 0, 0};
+            else if (v == 1)
+                pen.attr |= ATTR_BOLD;
+            else if (v == 4)
+                pen.attr |= ATTR_UNDERLINE;
+            else if (v == 7)
+                pen.attr |= ATTR_REVERSE;
+            else if (v == 22)
+                pen.attr &= ~ATTR_BOLD;
+            else if (v == 24)
+                pen.attr &= ~ATTR_UNDERLINE;
+            else if (v == 27)
+                pen.attr &= ~ATTR_REVERSE;
+            else if (v >= 30 && v <= 37)
+                pen.fg = v - 30;
+            else if (v == 39)
+                pen.fg = 7;
+            else if (v >= 40 && v <= 47)
+                pen.bg = v - 40;
+            else if (v == 49)
+                pen.bg = 0;
+            else if (v >= 90 && v <= 97)
+                pen.fg = v - 90;
+            else if (v >= 100 && v <= 107)
+                pen.bg = v - 100;
+            else if ((v == 38 || v == 48) && i + 1 < p.size())
+            {
+                // 256色只映射前16色, 真彩色忽略
+                if (p[i + 1] == 5 && i + 2 < p.size())
+                {
+                    if (p[i + 2] < 16)
+                        (v == 38 ? pen.fg : pen.bg) = p[i + 2] % 8;
+                    i += 2;
+                }
+                else if (p[i + 1] == 2)
+                {
+                    i += 4;
+                }
+            }
+        }
+    }
 
-                error = git_reference_peel((git_object **)&remote_commit, remote_ref, GIT_OBJ_COMMIT);
-                check_error(error, "peeling remote reference");
+    void csi(char final)
+    {
+        bool priv = !params.empty() && (params[0] == '?' || params[0] == '>' || params[0] == '=');
+        std::vector<int> p;
+        size_t start = priv ? 1 : 0;
+        while (start <= params.size())
+        {
+            size_t end = params.find_first_of(";:", start);
+            if (end == std::string::npos)
+                end = params.size();
+            // 只接受数字, 过大的值饱和到VT_PARAM_MAX, 负号等其他字节使该参数为0
+            int value = 0;
+            for (size_t i = start; i < end; ++i)
+            {
+                if (params[i] < '0' || params[i] > '9')
+                {
+                    value = 0;
+                    break;
+                }
+                value = std::min(VT_PARAM_MAX, value * 10 + (params[i] - '0'));
+            }
+            p.push_back(value);
+            start = end + 1;
+        }
+        int n = std::max(1, p[0]);
+        auto arg = [&](size_t i)
+        { return i < p.size() ? p[i] : 0; };
 
-                git_commit *parents[] = {local_commit, remote_commit};
+        if (priv)
+        {
+            if (params[0] == '?' && (final == 'h' || final == 'l'))
+                for (int mode : p)
+                    setMode(mode, final == 'h');
+            return;
+        }
 
-                error = git_commit_create(&new_commit_id, repo, "HEAD", signature, signature,
-                                          NULL, "Merge branch 'origin/master'", tree,
-                                          2, (const git_commit **)parents);
-                check_error(error, "creating merge commit");
+        switch (final)
+        {
+        case 'A':
+            moveTo(cy - n, cx);
+            break;
+        case 'B':
+        case 'e':
+            moveTo(cy + n, cx);
+            break;
+        case 'C':
+        case 'a':
+            moveTo(cy, cx + n);
+            break;
+        case 'D':
+            moveTo(cy, cx - n);
+            break;
+        case 'E':
+            moveTo(cy + n, 0);
+            break;
+        case 'F':
+            moveTo(cy - n, 0);
+            break;
+        case 'G':
+        case '`':
+            moveTo(cy, n - 1);
+            break;
+        case 'd':
+            moveTo(n - 1, cx);
+            break;
+        case 'H':
+        case 'f':
+            moveTo(std::max(1, arg(0)) - 1, std::max(1, arg(1)) - 1);
+            break;
+        case 'J':
+            if (arg(0) == 0)
+            {
+                erase(cy, cx, cols - 1);
+                for (int r = cy + 1; r < rows; ++r)
+                    erase(r, 0, cols - 1);
             }
+            else if (arg(0) == 1)
+            {
+                for (int r = 0; r < cy; ++r)
+                    erase(r, 0, cols - 1);
+                erase(cy, 0, cx);
+            }
+            else
+            {
+                for (int r = 0; r < rows; ++r)
+                    erase(r, 0, cols - 1);
+            }
+            break;
+        case 'K':
+            if (arg(0) == 0)
+                erase(cy, cx, cols - 1);
+            else if (arg(0) == 1)
+                erase(cy, 0, cx);
             else
+                erase(cy, 0, cols - 1);
+            break;
+        case 'L':
+            if (cy >= top && cy <= bottom)
+                scrollDown(cy, bottom, n);
+            break;
+        case 'M':
+            if (cy >= top && cy <= bottom)
+                scrollUp(cy, bottom, n);
+            break;
+        case '@':
+        {
+            n = std::min(n, cols - cx);
+            auto row = cells.begin() + cy * cols;
+            std::copy_backward(row + cx, row + cols - n, row + cols);
+            erase(cy, cx, cx + n - 1);
+            damage(cy, cx, cols - 1);
+            break;
+        }
+        case 'P':
+        {
+            n = std::min(n, cols - cx);
+            auto row = cells.begin() + cy * cols;
+            std::copy(row + cx + n, row + cols, row + cx);
+            erase(cy, cols - n, cols - 1);
+            damage(cy, cx, cols - 1);
+            break;
+        }
+        case 'X':
+            erase(cy, cx, cx + n - 1);
+            break;
+        case 'S':
+            scrollUp(top, bottom, n);
+            break;
+        case 'T':
+            scrollDown(top, bottom, n);
+            break;
+        case 'b':
+            // 重复次数来自输出流, 超过一屏没有意义, 避免损坏的录像卡住界面
+            n = std::min(n, rows * cols);
+            for (int i = 0; i < n; ++i)
+                put(lastChar);
+            break;
+        case 'r':
+        {
+            int first = arg(0) ? arg(0) - 1 : 0;
+            int last = arg(1) ? arg(1) - 1 : rows - 1;
+            if (first >= 0 && first < last && last < rows)
             {
-                std::cerr << "There are unresolved conflicts. Aborting." << std::endl;
+                top = first;
+                bottom = last;
             }
+            moveTo(0, 0);
+            break;
         }
-        else
+        case 'm':
+            selectGraphic(p);
+            break;
+        case 's':
+            saveCursor();
+            break;
+        case 'u':
+            restoreCursor();
+            break;
+        default:
+            break; // 设备查询等不需要回应
+        }
+    }
+
+public:
+    // 大小来自终端或录像文件头, 限制在1..VT_MAX_SIZE
+    vtScreen(int height, int width)
+        : rows(std::max(1, std::min(VT_MAX_SIZE, height))), cols(std::max(1, std::min(VT_MAX_SIZE, width)))
+    {
+        reset();
+    }
+
+    // 恢复初始状态(清屏)
+    void reset()
+    {
+        pen = cell{U' ', 7, 0, 0};
+        cells.assign(rows * cols, blank());
+        primary.clear();
+        alternate = false;
+        cx = cy = 0;
+        wrapPending = false;
+        top = 0;
+        bottom = rows - 1;
+        savedX = savedY = 0;
+        savedPen = pen;
+        cursorShown = true;
+        appCursor = false;
+        lastChar = U' ';
+        damageLo.assign(rows, 0);
+        damageHi.assign(rows, cols - 1);
+        state = parseState::GROUND;
+        params.clear();
+        stringEscape = false;
+        utf8Code = 0;
+        utf8Left = 0;
+    }
+
+    // 改变大小, 保留左上角内容
+    void resize(int height, int width)
+    {
+        std::vector<cell> old = cells;
+        int oldRows = rows, oldCols = cols;
+        rows = std::max(1, std::min(VT_MAX_SIZE, height));
+        cols = std::max(1, std::min(VT_MAX_SIZE, width));
+        cells.assign(rows * cols, blank());
+        for (int r = 0; r < std::min(rows, oldRows); ++r)
+            for (int c = 0; c < std::min(cols, oldCols); ++c)
+                cells[r * cols + c] = old[r * oldCols + c];
+        primary.clear();
+        alternate = false;
+        top = 0;
+        bottom = rows - 1;
+        moveTo(cy, cx);
+        damageLo.assign(rows, 0);
+        damageHi.assign(rows, cols - 1);
+    }
+
+    // 处理终端输出的字节流, 可以在任意位置被截断
+    void feed(const char *data, size_t len)
+    {
+        for (size_t i = 0; i < len; ++i)
         {
-            std::cerr << "Merge conflicts detected. Please resolve them manually." << std::endl;
+            unsigned char b = data[i];
+            switch (state)
+            {
+            case parseState::GROUND:
+                if (utf8Left > 0 && (b & 0xC0) == 0x80)
+                {
+                    utf8Code = (utf8Code << 6) | (b & 0x3F);
+                    if (--utf8Left == 0)
+                        put(utf8Code);
+                }
+                else if (b < 0x20 || b == 0x7f)
+                {
+                    utf8Left = 0;
+                    control(b);
+                }
+                else if (b < 0x80)
+                {
+                    utf8Left = 0;
+                    put(b);
+                }
+                else if ((b & 0xE0) == 0xC0)
+                {
+                    utf8Code = b & 0x1F;
+                    utf8Left = 1;
+                }
+                else if ((b & 0xF0) == 0xE0)
+                {
+                    utf8Code = b & 0x0F;
+                    utf8Left = 2;
+                }
+                else if ((b & 0xF8) == 0xF0)
+                {
+                    utf8Code = b & 0x07;
+                    utf8Left = 3;
+                }
+                else
+                {
+                    utf8Left = 0;
+                    put(0xFFFD);
+                }
+                break;
+            case parseState::ESCAPE:
+                escape(b);
+                break;
+            case parseState::CSI:
+                if (b >= 0x40 && b <= 0x7e)
+                {
+                    state = parseState::GROUND;
+                    csi(b);
+                }
+                else if (b < 0x20)
+                {
+                    control(b);
+                }
+                else
+                {
+                    params += (char)b;
+                }
+                break;
+            case parseState::STRING:
+                if (b == 0x07 || (stringEscape && b == '\\'))
+                    state = parseState::GROUND;
+                stringEscape = (b == 0x1b);
+                break;
+            case parseState::CHARSET:
+                state = parseState::GROUND;
+                break;
+            }
         }
     }
 
-    // 清理资源
-    git_tree_free(tree);
-    git_signature_free(signature);
-    git_commit_free(local_commit);
-    git_commit_free(remote_commit);
-    git_annotated_commit_free(annotated_commit);
-    git_reference_free(remote_ref);
-    git_reference_free(local_ref);
-    git_remote_free(remote);
-    git_repository_free(repo);
-    git_libgit2_shutdown();
+    int height() const
+    {
+        return rows;
+    }
 
-    return 0;
-}
+    int width() const
+    {
+        return cols;
+    }
 
-// 初始化
-void init(std::filesystem::path &workDir)
-{
-    nlohmann::json student;
-    std::string specialization = specializationChoice();
-    student["specialization"] = specialization;
-    studentInfo(student);
-    std::string editor = editorChoice();
-    student["editor"] = editor;
-    student["lab_sh"] = {"lab1.sh", "lab2.sh", "lab3.sh", "lab4.sh"};
-    student["lab_dir"] = {"lab1", "lab2", "lab3", "lab4"};
-    student["lab1"] = nlohmann::json::array();
-    student["lab2"] = nlohmann::json::array();
-    student["lab3"] = nlohmann::json::array();
-    student["lab4"] = nlohmann::json::array();
-    std::ofstream outFile(workDir / "student.json");
-    outFile << student.dump(4);
-    outFile.close();
-    std::ofstream initFile(workDir / "README.md");
-    initFile.close();
-    for (int i = 0; i < student["lab_dir"].size(); i++)
+    const cell &at(int row, int col) const
     {
-        std::filesystem::create_directories(workDir / student["lab_dir"][i]);
-        std::ofstream outfile(workDir / student["lab_dir"][i] / student["lab_sh"][i]);
+        return cells[row * cols + col];
     }
-    std::filesystem::create_directories(workDir / "Require");
 
-    std::string workDirStr = workDir.string();
-    std::string name = student["name"];
-    std::string email = student["email"];
-    std::string url = student["git"];
+    int cursorRow() const
+    {
+        return cy;
+    }
 
-    git_init_with_config(workDirStr, name, email);
-    git_add_all(workDirStr);
-    use_git_commit(workDirStr, "init");
-    git_remote_add_origin(workDirStr, url);
-    use_git_push(workDirStr, url);
-}
+    int cursorCol() const
+    {
+        return cx;
+    }
 
-// welcome
-void welcome()
-{
-    const char *WELCOME_TEXT =
-        R"(
-__        _______ _     ____ ___  __  __ _____ 
-\ \      / / ____| |   / ___/ _ \|  \/  | ____|
- \ \ /\ / /|  _| | |  | |  | | | | |\/| |  _|  
-  \ V  V / | |___| |__| |__| |_| | |  | | |___ 
-   \_/\_/  |_____|_____\____\___/|_|  |_|_____|
-)";
+    bool cursorVisible() const
+    {
+        return cursorShown;
+    }
+
+    bool applicationCursor() const
+    {
+        return appCursor;
+    }
+
+    bool damaged() const
+    {
+        for (int r = 0; r < rows; ++r)
+            if (damageLo[r] <= damageHi[r])
+                return true;
+        return false;
+    }
+
+    // 下次render时重绘全部内容
+    void touch()
+    {
+        damageAll();
+    }
+
+    // 只把改动过的格子画到窗口上
+    void render(WINDOW *win)
+    {
+        static bool pairReady[64] = {false};
+        int h, w;
+        getmaxyx(win, h, w);
+        for (int r = 0; r < std::min(rows, h); ++r)
+        {
+            if (damageLo[r] > damageHi[r])
+                continue;
+            int from = damageLo[r];
+            if (from > 0 && at(r, from).ch == 0)
+                from--; // 从宽字符的左半格开始画
+            for (int c = from; c <= std::min(damageHi[r], w - 1); ++c)
+            {
+                const cell &value = at(r, c);
+                if (value.ch == 0)
+                    continue;
+                attr_t attrs = A_NORMAL;
+                if (value.attr & ATTR_BOLD)
+                    attrs |= A_BOLD;
+                if (value.attr & ATTR_UNDERLINE)
+                    attrs |= A_UNDERLINE;
+                if (value.attr & ATTR_REVERSE)
+                    attrs |= A_REVERSE;
+                int pair = VT_COLOR_PAIR_BASE + value.fg * 8 + value.bg;
+                if (has_colors() && pair < COLOR_PAIRS)
+                {
+                    if (!pairReady[pair - VT_COLOR_PAIR_BASE])
+                    {
+                        init_pair(pair, value.fg, value.bg);
+                        pairReady[pair - VT_COLOR_PAIR_BASE] = true;
+                    }
+                    attrs |= COLOR_PAIR(pair);
+                }
+                if (value.ch < 0x80)
+                {
+                    mvwaddch(win, r, c, value.ch | attrs);
+                }
+                else
+                {
+                    char utf8[5] = {0};
+                    char32_t ch = value.ch;
+                    if (ch < 0x800)
+                    {
+                        utf8[0] = 0xC0 | (ch >> 6);
+                        utf8[1] = 0x80 | (ch & 0x3F);
+                    }
+                    else if (ch < 0x10000)
+                    {
+                        utf8[0] = 0xE0 | (ch >> 12);
+                        utf8[1] = 0x80 | ((ch >> 6) & 0x3F);
+                        utf8[2] = 0x80 | (ch & 0x3F);
+                    }
+                    else
+                    {
+                        utf8[0] = 0xF0 | (ch >> 18);
+                        utf8[1] = 0x80 | ((ch >> 12) & 0x3F);
+                        utf8[2] = 0x80 | ((ch >> 6) & 0x3F);
+                        utf8[3] = 0x80 | (ch & 0x3F);
+                    }
+                    wattrset(win, attrs);
+                    mvwaddstr(win, r, c, utf8);
+                    wattrset(win, A_NORMAL);
+                }
+            }
+            damageLo[r] = cols;
+            damageHi[r] = -1;
+        }
+    }
+};
+
+// ncurses按键转换为终端发给程序的字节序列
+std::string vt_key_sequence(int key, bool applicationCursor)
+{
+    const char *cursor = applicationCursor ? "\033O" : "\033[";
+    switch (key)
+    {
+    case KEY_UP:
+        return std::string(cursor) + "A";
+    case KEY_DOWN:
+        return std::string(cursor) + "B";
+    case KEY_RIGHT:
+        return std::string(cursor) + "C";
+    case KEY_LEFT:
+        return std::string(cursor) + "D";
+    case KEY_HOME:
+        return std::string(cursor) + "H";
+    case KEY_END:
+        return std::string(cursor) + "F";
+    case KEY_IC:
+        return "\033[2~";
+    case KEY_DC:
+        return "\033[3~";
+    case KEY_PPAGE:
+        return "\033[5~";
+    case KEY_NPAGE:
+        return "\033[6~";
+    case KEY_BTAB:
+        return "\033[Z";
+    case KEY_BACKSPACE:
+        return "\177";
+    case KEY_ENTER:
+    case '\n':
+        return "\r";
+    default:
+        break;
+    }
+    if (key >= KEY_F(1) && key <= KEY_F(4))
+        return std::string("\033O") + (char)('P' + key - KEY_F(1));
+    if (key >= KEY_F(5) && key <= KEY_F(12))
+    {
+        static const int codes[] = {15, 17, 18, 19, 20, 21, 23, 24};
+        return "\033[" + std::to_string(codes[key - KEY_F(5)]) + "~";
+    }
+    if (key >= 0 && key < 256)
+        return std::string(1, (char)key);
+    return ""; // KEY_RESIZE 等
+}
+
+// 在Shell面板中运行编辑器并录制, 其余面板保持显示
+/**
+ * pane: 编辑器占用的窗口(Shell面板的内部区域)
+ * editor: 编辑器
+ * filename: 文件名
+ * recording_file: 记录文件名
+ */
+void edit_in_pane(WINDOW *pane,
+                  const std::string &editor,
+                  const std::string &filename,
+                  const std::string &recording_file)
+{
+    TRACE_SPAN("editor", "child");
+    std::filesystem::path segment_dir = cast_segment_dir(recording_file);
+    std::filesystem::create_directories(segment_dir);
+    std::filesystem::path raw_file = cast_raw_file();
+    std::time_t started = std::time(nullptr);
+
+    int rows, cols;
+    getmaxyx(pane, rows, cols);
+    struct winsize size = {};
+    size.ws_row = rows;
+    size.ws_col = cols;
+
+    castWriter writer;
+    if (!writer.open(raw_file, cols, rows))
+        throw std::runtime_error("Failed to open recording file");
+
+    // 参数和环境(TERM改为面板模拟的终端)在 fork 之前准备: 后台线程可能正持有
+    // malloc 或环境变量的锁, 子进程中只做赋值和 exec
+    std::string command = editor_command(editor);
+    char *const argv[] = {const_cast<char *>(command.c_str()), const_cast<char *>(filename.c_str()), nullptr};
+    std::vector<std::string> envStrings = {std::string("TERM=") + VT_TERM};
+    for (char **env = environ; *env; ++env)
+    {
+        if (strncmp(*env, "TERM=", 5) != 0)
+            envStrings.push_back(*env);
+    }
+    std::vector<char *> envp;
+    for (auto &entry : envStrings)
+        envp.push_back(&entry[0]);
+    envp.push_back(nullptr);
+
+    int master = -1;
+    pid_t pid = forkpty(&master, nullptr, nullptr, &size);
+    if (pid == -1)
+    {
+        writer.close();
+        std::filesystem::remove(raw_file);
+        throw std::runtime_error("Failed to fork process");
+    }
+    else if (pid == 0)
+    {
+        environ = envp.data();
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+
+    // Ctrl-C/Ctrl-Z 等按键交给编辑器处理
+    raw();
+    int escDelay = get_escdelay();
+    set_escdelay(VT_ESCDELAY_MS);
+    keypad(pane, TRUE);
+    nodelay(pane, TRUE);
+    werase(pane);
+
+    vtScreen screen(rows, cols);
+    char buf[8192];
+    bool running = true;
+    while (running)
+    {
+        struct pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0}, {master, POLLIN, 0}};
+        int ready = poll(fds, 2, CAST_FLUSH_MS / 4);
+        if (ready < 0 && errno != EINTR)
+            break;
+
+        if (ready > 0 && (fds[0].revents & POLLIN))
+        {
+            std::string keys;
+            int key;
+            while ((key = wgetch(pane)) != ERR)
+                keys += vt_key_sequence(key, screen.applicationCursor());
+            if (!keys.empty())
+            {
+                write(master, keys.data(), keys.size());
+                writer.event('i', keys.data(), keys.size());
+            }
+        }
+        if (ready > 0 && (fds[1].revents & (POLLIN | POLLHUP | POLLERR)))
+        {
+            ssize_t n = read(master, buf, sizeof(buf));
+            if (n > 0)
+            {
+                screen.feed(buf, n);
+                writer.event('o', buf, n);
+            }
+            else if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            else
+            {
+                running = false; // EIO: 编辑器已退出
+            }
+        }
+
+        if (screen.damaged())
+        {
+            screen.render(pane);
+            curs_set(screen.cursorVisible() ? 1 : 0);
+            wmove(pane, screen.cursorRow(), screen.cursorCol());
+            wrefresh(pane);
+        }
+        writer.flushIfDue();
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    close(master);
+    writer.close();
+
+    nodelay(pane, FALSE);
+    set_escdelay(escDelay);
+    noraw();
+    cbreak();
+    curs_set(0);
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) == 127)
+    {
+        std::filesystem::remove(raw_file);
+        throw std::runtime_error("editor session failed");
+    }
+    store_cast_segment(raw_file, segment_dir, started);
+}
+
+// 启动子进程(不经过shell), stdout和stderr写入同一个管道
+// 成功返回0, pid为子进程pid, out_fd为管道读端; 失败返回错误码(errno值)
+// 管道带 O_CLOEXEC, 其他线程同时启动的编辑器或脚本不会继承写端而推迟EOF
+int spawn_piped(const std::vector<std::string> &args, pid_t &pid, int &out_fd)
+{
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) < 0)
+        return errno;
+
+    std::vector<char *> argv;
+    for (const auto &arg : args)
+        argv.push_back(const_cast<char *>(arg.c_str()));
+    argv.push_back(nullptr);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDERR_FILENO);
+    posix_spawn_file_actions_addclose(&actions, fds[0]);
+    posix_spawn_file_actions_addclose(&actions, fds[1]);
+
+    pid = -1;
+    int error = posix_spawnp(&pid, argv[0], &actions, nullptr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[1]);
+    if (error != 0)
+    {
+        close(fds[0]);
+        pid = -1;
+        return error;
+    }
+    out_fd = fds[0];
+    return 0;
+}
+
+// ShellCheck 选项: 输出结构化的 json1 格式, 由 diagnosticTable 解析
+const std::vector<std::string> SHELLCHECK_OPTIONS = {"-f", "json1"};
+
+// 运行ShellCheck, 输出到达时逐块交给 onOutput
+// 返回ShellCheck的退出码, 无法启动时返回-1
+// child 非空时记录子进程pid, 供其他线程取消检查
+int runShellCheck(const std::string &scriptPath,
+                  const std::function<void(const char *, size_t)> &onOutput,
+                  std::atomic<pid_t> *child = nullptr)
+{
+    TRACE_SPAN("shellcheck", "child");
+    int fd = -1;
+    std::vector<std::string> args = {"shellcheck"};
+    args.insert(args.end(), SHELLCHECK_OPTIONS.begin(), SHELLCHECK_OPTIONS.end());
+    args.push_back(scriptPath);
+    pid_t pid = -1;
+    int error = spawn_piped(args, pid, fd);
+    if (child)
+        *child = pid;
+    if (error != 0)
+    {
+        std::string message = "无法启动 shellcheck: " + std::string(strerror(error)) + "\n";
+        onOutput(message.data(), message.size());
+        return -1;
+    }
+
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) != 0)
+    {
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        onOutput(buf, n);
+    }
+    close(fd);
+
+    // 回收前清除pid, 避免取消时误杀复用了该pid的进程
+    if (child)
+        *child = -1;
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// ShellCheck 结果缓存
+// 键为脚本内容、路径、ShellCheck版本和选项的哈希, 存放在 .git/shellcheck-cache/
+// 命中时更新文件修改时间, 超出数量时淘汰最久未用的条目
+#define SHELLCHECK_CACHE_ENTRIES 64
+
+// FNV-1a 64位哈希
+uint64_t fnv1a64(const std::string &data, uint64_t hash = 1469598103934665603ULL)
+{
+    for (unsigned char c : data)
+    {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// ShellCheck版本只在每个进程中查询一次
+const std::string &shellcheck_version()
+{
+    static std::once_flag once;
+    static std::string version;
+    std::call_once(once, []()
+                   {
+                       int fd = -1;
+                       pid_t pid = -1;
+                       if (spawn_piped({"shellcheck", "--version"}, pid, fd) != 0)
+                           return;
+                       char buf[512];
+                       ssize_t n;
+                       while ((n = read(fd, buf, sizeof(buf))) > 0)
+                           version.append(buf, n);
+                       close(fd);
+                       waitpid(pid, nullptr, 0);
+                   });
+    return version;
+}
+
+bool read_file(const std::filesystem::path &path, std::string &content)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open())
+        return false;
+    content.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return true;
+}
+
+std::filesystem::path shellcheck_cache_entry(const std::filesystem::path &repo_path,
+                                             const std::string &scriptPath,
+                                             const std::vector<std::string> &options)
+{
+    std::string script;
+    read_file(scriptPath, script);
+    uint64_t hash = fnv1a64(script);
+    hash = fnv1a64(scriptPath, hash);
+    hash = fnv1a64(shellcheck_version(), hash);
+    for (const auto &option : options)
+        hash = fnv1a64(option + '\0', hash);
+
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.txt", (unsigned long long)hash);
+    return repo_path / ".git" / "shellcheck-cache" / name;
+}
+
+// 删除最久未使用的缓存条目
+void evict_shellcheck_cache(const std::filesystem::path &cache_dir, size_t keep = SHELLCHECK_CACHE_ENTRIES)
+{
+    std::vector<std::pair<std::filesystem::file_time_type, std::filesystem::path>> entries;
+    std::error_code ec;
+    for (const auto &entry : std::filesystem::directory_iterator(cache_dir, ec))
+        entries.emplace_back(entry.last_write_time(ec), entry.path());
+    if (entries.size() <= keep)
+        return;
+    std::sort(entries.begin(), entries.end());
+    for (size_t i = 0; i < entries.size() - keep; ++i)
+        std::filesystem::remove(entries[i].second, ec);
+}
+
+// 带缓存的ShellCheck: 脚本未变时直接返回上次的结果
+int runShellCheckCached(const std::filesystem::path &repo_path, const std::string &scriptPath,
+                        const std::function<void(const char *, size_t)> &onOutput,
+                        std::atomic<pid_t> *child = nullptr)
+{
+    std::filesystem::path entry = shellcheck_cache_entry(repo_path, scriptPath, SHELLCHECK_OPTIONS);
+    std::string cached;
+    std::error_code ec;
+    if (read_file(entry, cached))
+    {
+        // 第一行记录退出码
+        size_t nl = cached.find('\n');
+        int status = atoi(cached.c_str());
+        std::filesystem::last_write_time(entry, std::filesystem::file_time_type::clock::now(), ec);
+        if (nl != std::string::npos)
+            onOutput(cached.data() + nl + 1, cached.size() - nl - 1);
+        return status;
+    }
+
+    std::string output;
+    int status = runShellCheck(scriptPath, [&](const char *data, size_t len)
+                               {
+                                   output.append(data, len);
+                                   onOutput(data, len);
+                               },
+                               child);
+    if (status < 0)
+        return status;
+
+    std::filesystem::create_directories(entry.parent_path(), ec);
+    std::ofstream out(temp_sibling(entry), std::ios::binary | std::ios::trunc);
+    out << status << '\n'
+        << output;
+    out.close();
+    std::filesystem::rename(temp_sibling(entry), entry, ec);
+    evict_shellcheck_cache(entry.parent_path());
+    return status;
+}
+
+// 后台预检查
+// 编辑器退出且脚本有变化时立即在后台运行ShellCheck, 按 c 时结果通常已就绪;
+// 检查未完成前再次编辑会取消上一次检查
+class lintWorker
+{
+private:
+    std::thread worker;
+    std::mutex mtx;
+    std::atomic<pid_t> child;
+    bool cancelled;
+    uint64_t runningHash; // 正在检查的脚本内容哈希
+    uint64_t readyHash;   // 已就绪结果对应的内容哈希
+    std::string readyPath;
+    std::string readyOutput;
+    bool fresh;           // 结果尚未被主循环取走
+
+    static uint64_t contentHash(const std::string &scriptPath)
+    {
+        std::string content;
+        read_file(scriptPath, content);
+        return fnv1a64(content);
+    }
+
+public:
+    lintWorker()
+        : child(-1), cancelled(false), runningHash(0), readyHash(0), fresh(false)
+    {
+    }
+
+    ~lintWorker()
+    {
+        cancel();
+    }
+
+    void start(const std::filesystem::path &repo_path, const std::string &scriptPath)
+    {
+        cancel();
+        uint64_t hash = contentHash(scriptPath);
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            cancelled = false;
+            runningHash = hash;
+        }
+        worker = std::thread([this, repo_path, scriptPath, hash]()
+                             {
+                                 std::string output;
+                                 runShellCheckCached(repo_path, scriptPath, [&](const char *data, size_t len)
+                                                     { output.append(data, len); },
+                                                     &child);
+                                 std::lock_guard<std::mutex> lock(mtx);
+                                 if (!cancelled)
+                                 {
+                                     readyHash = hash;
+                                     readyPath = scriptPath;
+                                     readyOutput = output;
+                                     fresh = true;
+                                 }
+                                 runningHash = 0;
+                             });
+    }
+
+    void cancel()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            cancelled = true;
+        }
+        pid_t pid = child;
+        if (pid > 0)
+            kill(pid, SIGTERM);
+        if (worker.joinable())
+            worker.join();
+    }
+
+    bool busy()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        return runningHash != 0;
+    }
+
+    // 新完成的结果只返回一次, 供主循环更新标记栏
+    bool takeFresh(std::string &scriptPath, std::string &output)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!fresh)
+            return false;
+        fresh = false;
+        scriptPath = readyPath;
+        output = readyOutput;
+        return true;
+    }
+
+    // 取出与脚本当前内容一致的结果; 若正在检查当前内容则等待其完成
+    bool take(const std::string &scriptPath, std::string &output)
+    {
+        uint64_t hash = contentHash(scriptPath);
+        bool running;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            running = runningHash == hash;
+        }
+        if (running && worker.joinable())
+            worker.join();
+
+        std::lock_guard<std::mutex> lock(mtx);
+        if (readyHash != hash || readyPath != scriptPath)
+            return false;
+        output = readyOutput;
+        return true;
+    }
+};
+
+// ShellCheck 诊断表
+// 解析 json1 输出, 按行号排序, 查找下一条诊断为二分查找
+struct shellDiagnostic
+{
+    int line = 0; // 从1开始
+    int column = 0;
+    std::string level; // error / warning / info / style
+    int code = 0;
+    std::string message;
+};
+
+class diagnosticTable
+{
+private:
+    std::vector<shellDiagnostic> items;
+
+    static int severity(const std::string &level)
+    {
+        if (level == "error")
+            return 3;
+        if (level == "warning")
+            return 2;
+        if (level == "info")
+            return 1;
+        return 0;
+    }
+
+public:
+    // 输出不是合法json1(如shellcheck报错)时返回false
+    bool parse(const std::string &output)
+    {
+        items.clear();
+        nlohmann::json result = nlohmann::json::parse(output, nullptr, false);
+        if (result.is_discarded() || !result.contains("comments") || !result["comments"].is_array())
+            return false;
+        for (const auto &comment : result["comments"])
+        {
+            shellDiagnostic item;
+            item.line = comment.value("line", 0);
+            item.column = comment.value("column", 0);
+            item.level = comment.value("level", "");
+            item.code = comment.value("code", 0);
+            item.message = comment.value("message", "");
+            items.push_back(item);
+        }
+        std::sort(items.begin(), items.end(), [](const shellDiagnostic &a, const shellDiagnostic &b)
+                  { return a.line != b.line ? a.line < b.line : a.column < b.column; });
+        return true;
+    }
+
+    void clear()
+    {
+        items.clear();
+    }
+
+    bool empty() const
+    {
+        return items.empty();
+    }
+
+    size_t count(const std::string &level) const
+    {
+        return std::count_if(items.begin(), items.end(), [&](const shellDiagnostic &d)
+                             { return d.level == level; });
+    }
+
+    // 行号大于 line 的第一条诊断, 到末尾后回到第一条
+    const shellDiagnostic *next(int line) const
+    {
+        if (items.empty())
+            return nullptr;
+        auto it = std::upper_bound(items.begin(), items.end(), line, [](int l, const shellDiagnostic &d)
+                                   { return l < d.line; });
+        return it == items.end() ? &items.front() : &*it;
+    }
+
+    // 每行最严重诊断的标记字符: E/W/I/S
+    std::vector<char> gutter(size_t lineCount) const
+    {
+        std::vector<char> marks(lineCount, ' ');
+        std::vector<int> worst(lineCount, -1);
+        for (const auto &item : items)
+        {
+            if (item.line < 1 || item.line > (int)lineCount)
+                continue;
+            int s = severity(item.level);
+            if (s > worst[item.line - 1])
+            {
+                worst[item.line - 1] = s;
+                marks[item.line - 1] = "SIWE"[s];
+            }
+        }
+        return marks;
+    }
+
+    // 检查面板中显示的文本
+    std::string format() const
+    {
+        if (items.empty())
+            return "No issues detected.\n";
+        std::string text;
+        for (const auto &item : items)
+        {
+            text += "line " + std::to_string(item.line) + ":" + std::to_string(item.column) +
+                    " [" + item.level + "] SC" + std::to_string(item.code) + ": " + item.message + "\n";
+        }
+        return text;
+    }
+};
+
+// git操作函数
+
+// git init
+bool git_init_with_config(const std::string &working_dir,
+                          const std::string &user_name,
+                          const std::string &user_email,
+                          bool global_config = false)
+{
+    // // 初始化libgit2库
+    // if (git_libgit2_init() < 0)
+    // {
+    //     const git_error *e = giterr_last();
+    //     std::cerr << "Failed to initialize libgit2: "
+    //               << (e ? e->message : "Unknown error") << '\n';
+    //     return false;
+    // }
+
+    // 初始化Git仓库
+    git_repository *repo = nullptr;
+    int result = git_repository_init(&repo, working_dir.c_str(), 0);
+
+    if (result >= 0)
+    {
+        // 打开配置（仓库级或全局）
+        git_config *cfg = nullptr;
+        if (global_config ? git_config_open_default(&cfg) >= 0
+                          : git_repository_config(&cfg, repo) >= 0)
+        {
+            // 设置用户名称
+            if (git_config_set_string(cfg, "user.name", user_name.c_str()) < 0)
+            {
+                const git_error *e = giterr_last();
+                std::cerr << "Failed to set user.name: "
+                          << (e ? e->message : "Unknown error") << '\n';
+                result = -1;
+            }
+
+            // 设置用户邮箱
+            if (result >= 0 && git_config_set_string(cfg, "user.email", user_email.c_str()) < 0)
+            {
+                const git_error *e = giterr_last();
+                std::cerr << "Failed to set user.email: "
+                          << (e ? e->message : "Unknown error") << '\n';
+                result = -1;
+            }
+
+            git_config_free(cfg);
+        }
+        else
+        {
+            const git_error *e = giterr_last();
+            std::cerr << "Failed to open config: "
+                      << (e ? e->message : "Unknown error") << '\n';
+            result = -1;
+        }
+    }
+
+    // 清理资源
+    if (repo)
+        git_repository_free(repo);
+    //git_libgit2_shutdown();
+
+    // 处理结果
+    if (result < 0)
+    {
+        return false;
+    }
+
+    // std::cout << "Initialized empty Git repository in " << working_dir << '\n';
+    // std::cout << "Configured user.name = " << user_name
+    //           << (global_config ? " (global)" : "") << '\n';
+    // std::cout << "Configured user.email = " << user_email
+    //           << (global_config ? " (global)" : "") << '\n';
+    return true;
+}
+
+// git add
+bool git_add_all(const std::string &repo_path)
+{
+    TRACE_SPAN("git_add_all", "git");
+    // // 初始化libgit2库
+    // if (git_libgit2_init() < 0)
+    // {
+    //     const git_error *e = giterr_last();
+    //     std::cerr << "Failed to initialize libgit2: "
+    //               << (e ? e->message : "Unknown error") << '\n';
+    //     return false;
+    // }
+
+    git_repository *repo = nullptr;
+    git_index *index = nullptr;
+    int result = 0;
+
+    // 打开仓库
+    if (git_repository_open(&repo, repo_path.c_str()) < 0)
+    {
+        const git_error *e = giterr_last();
+        std::cerr << "Failed to open repository: "
+                  << (e ? e->message : "Unknown error") << '\n';
+        result = -1;
+        goto cleanup;
+    }
+
+    // 获取仓库索引
+    if (git_repository_index(&index, repo) < 0)
+    {
+        const git_error *e = giterr_last();
+        std::cerr << "Failed to get repository index: "
+                  << (e ? e->message : "Unknown error") << '\n';
+        result = -1;
+        goto cleanup;
+    }
+
+    // 添加所有工作目录更改到索引
+    if (git_index_add_all(index, nullptr, 0, nullptr, nullptr) < 0)
+    {
+        const git_error *e = giterr_last();
+        std::cerr << "Failed to add files to index: "
+                  << (e ? e->message : "Unknown error") << '\n';
+        result = -1;
+        goto cleanup;
+    }
+
+    // 写入索引到磁盘
+    if (git_index_write(index) < 0)
+    {
+        const git_error *e = giterr_last();
+        std::cerr << "Failed to write index: "
+                  << (e ? e->message : "Unknown error") << '\n';
+        result = -1;
+        goto cleanup;
+    }
+
+    // std::cout << "Added all changes to the staging area.\n";
+
+cleanup:
+    // 清理资源
+    if (index)
+        git_index_free(index);
+    if (repo)
+        git_repository_free(repo);
+    //git_libgit2_shutdown();
+
+    return result == 0;
+}
+
+// 在上一次提交的树上只重写有变化的子树
+// 索引按路径排序, 同一目录下的条目是连续的; pos 从当前目录的第一个条目开始,
+// 返回时指向目录之后的条目. 未变化的子树(如其他 lab*/、Require/)直接复用原OID
+int git_write_changed_tree(git_oid *out, git_repository *repo, git_index *index,
+                           size_t &pos, const std::string &prefix, const git_tree *base)
+{
+    struct treeChange
+    {
+        std::string name;
+        git_oid id;
+        git_filemode_t mode;
+    };
+    std::vector<treeChange> changes;
+    std::unordered_set<std::string> seen;
+    size_t count = git_index_entrycount(index);
+    int error = 0;
+
+    while (pos < count)
+    {
+        const git_index_entry *entry = git_index_get_byindex(index, pos);
+        std::string path = entry->path;
+        if (path.compare(0, prefix.size(), prefix) != 0)
+            break;
+
+        std::string rest = path.substr(prefix.size());
+        size_t slash = rest.find('/');
+        std::string name = rest.substr(0, slash);
+        const git_tree_entry *base_entry = base ? git_tree_entry_byname(base, name.c_str()) : nullptr;
+        seen.insert(name);
+
+        if (slash == std::string::npos)
+        {
+            // 文件: OID和模式都相同则不变
+            git_filemode_t mode = (git_filemode_t)entry->mode;
+            if (!base_entry || git_tree_entry_filemode(base_entry) != mode ||
+                !git_oid_equal(git_tree_entry_id(base_entry), &entry->id))
+                changes.push_back({name, entry->id, mode});
+            pos++;
+            continue;
+        }
+
+        // 子目录: 递归处理, 结果与原子树相同则复用
+        git_tree *base_subtree = nullptr;
+        if (base_entry && git_tree_entry_type(base_entry) == GIT_OBJECT_TREE)
+        {
+            error = git_tree_lookup(&base_subtree, repo, git_tree_entry_id(base_entry));
+            if (error < 0)
+                return error;
+        }
+        git_oid subtree_id;
+        error = git_write_changed_tree(&subtree_id, repo, index, pos, prefix + name + "/", base_subtree);
+        git_tree_free(base_subtree);
+        if (error < 0)
+            return error;
+        if (!base_entry || git_tree_entry_type(base_entry) != GIT_OBJECT_TREE ||
+            !git_oid_equal(git_tree_entry_id(base_entry), &subtree_id))
+            changes.push_back({name, subtree_id, GIT_FILEMODE_TREE});
+    }
+
+    // 原树中有、索引中已没有的条目需要删除
+    std::vector<std::string> removed;
+    for (size_t i = 0; base && i < git_tree_entrycount(base); ++i)
+    {
+        const char *name = git_tree_entry_name(git_tree_entry_byindex(base, i));
+        if (seen.find(name) == seen.end())
+            removed.push_back(name);
+    }
+
+    if (base && changes.empty() && removed.empty())
+    {
+        git_oid_cpy(out, git_tree_id(base));
+        return 0;
+    }
+
+    git_treebuilder *builder = nullptr;
+    error = git_treebuilder_new(&builder, repo, base);
+    if (error < 0)
+        return error;
+    for (const auto &change : changes)
+    {
+        error = git_treebuilder_insert(nullptr, builder, change.name.c_str(), &change.id, change.mode);
+        if (error < 0)
+            break;
+    }
+    for (size_t i = 0; error >= 0 && i < removed.size(); ++i)
+        error = git_treebuilder_remove(builder, removed[i].c_str());
+    if (error >= 0)
+        error = git_treebuilder_write(out, builder);
+    git_treebuilder_free(builder);
+    return error;
+}
+
+// git commit
+bool use_git_commit(const std::string &repo_path, const std::string &message)
+{
+    TRACE_SPAN("use_git_commit", "git");
+    // 初始化libgit2库
+    //git_libgit2_init();
+
+    // 声明所有需要释放的资源
+    git_repository *repo = nullptr;
+    git_index *index = nullptr;
+    git_signature *signature = nullptr;
+    git_tree *tree = nullptr;
+    git_commit *parent_commit = nullptr;
+    bool success = false;
+
+    try
+    {
+        // 1. 打开Git仓库
+        if (git_repository_open(&repo, repo_path.c_str()) < 0)
+        {
+            throw std::runtime_error("无法打开仓库: " + std::string(giterr_last()->message));
+        }
+
+        // 2. 获取并刷新索引
+        if (git_repository_index(&index, repo) < 0)
+        {
+            throw std::runtime_error("无法获取索引: " + std::string(giterr_last()->message));
+        }
+        if (git_index_read(index, 0) < 0)
+        { // 索引文件有变化时才重新读取
+            throw std::runtime_error("无法刷新索引: " + std::string(giterr_last()->message));
+        }
+
+        // 3. 检查是否有待提交的更改
+        if (git_index_entrycount(index) == 0)
+        {
+            throw std::runtime_error("没有待提交的更改");
+        }
+        if (git_index_has_conflicts(index))
+        {
+            throw std::runtime_error("索引中有未解决的冲突");
+        }
+
+        // 4. 获取父提交(如果不是首次提交)
+        git_oid parent_id;
+        const git_commit *parents[1] = {nullptr};
+        int parent_count = 0;
+
+        if (git_reference_name_to_id(&parent_id, repo, "HEAD") == 0)
+        {
+            if (git_commit_lookup(&parent_commit, repo, &parent_id) < 0)
+            {
+                throw std::runtime_error("无法查找父提交: " + std::string(giterr_last()->message));
+            }
+            parents[0] = parent_commit;
+            parent_count = 1;
+        }
+
+        // 5. 创建树对象: 有父提交时在其树上只重写变化的子树
+        git_oid tree_id;
+        if (parent_commit)
+        {
+            git_tree *parent_tree = nullptr;
+            if (git_commit_tree(&parent_tree, parent_commit) < 0)
+            {
+                throw std::runtime_error("无法读取父提交的树: " + std::string(giterr_last()->message));
+            }
+            size_t pos = 0;
+            int error = git_write_changed_tree(&tree_id, repo, index, pos, "", parent_tree);
+            git_tree_free(parent_tree);
+            if (error < 0)
+            {
+                throw std::runtime_error("无法写入树对象: " + std::string(giterr_last()->message));
+            }
+        }
+        else if (git_index_write_tree(&tree_id, index) < 0)
+        {
+            throw std::runtime_error("无法写入树对象: " + std::string(giterr_last()->message));
+        }
+        if (git_tree_lookup(&tree, repo, &tree_id) < 0)
+        {
+            throw std::runtime_error("无法查找树对象: " + std::string(giterr_last()->message));
+        }
+
+        // 6. 创建签名(带多重回退机制)
+        if (git_signature_default(&signature, repo) < 0)
+        {
+            // 尝试从环境变量获取
+            const char *name = std::getenv("GIT_AUTHOR_NAME");
+            const char *email = std::getenv("GIT_AUTHOR_EMAIL");
+            if (!name || !email || git_signature_now(&signature, name, email) < 0)
+            {
+                // 最终回退方案
+                if (git_signature_now(&signature, "Git User", "user@example.com") < 0)
+                {
+                    throw std::runtime_error("无法创建签名: " + std::string(giterr_last()->message));
+                }
+            }
+        }
+
+        // 7. 创建提交
+        git_oid commit_id;
+        if (git_commit_create(
+                &commit_id,
+                repo,
+                "HEAD",
+                signature,
+                signature,
+                "UTF-8",
+                message.c_str(),
+                tree,
+                parent_count,
+                parent_count ? parents : nullptr) < 0)
+        {
+            throw std::runtime_error("无法创建提交: " + std::string(giterr_last()->message));
+        }
+
+        // std::cout << "提交成功: " << git_oid_tostr_s(&commit_id) << std::endl;
+        success = true;
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "错误: " << e.what() << std::endl;
+        if (const git_error *err = giterr_last())
+        {
+            std::cerr << "Git错误详情: " << err->message << std::endl;
+        }
+    }
+
+    // 释放所有资源
+    if (signature)
+        git_signature_free(signature);
+    if (tree)
+        git_tree_free(tree);
+    if (parent_commit)
+        git_commit_free(parent_commit);
+    if (index)
+        git_index_free(index);
+    if (repo)
+        git_repository_free(repo);
+
+    //git_libgit2_shutdown();
+    return success;
+}
+
+// git remote
+bool git_remote_add_origin(const std::string &repo_path, const std::string &url)
+{
+    // // 初始化libgit2库
+    // if (git_libgit2_init() < 0)
+    // {
+    //     const git_error *e = giterr_last();
+    //     std::cerr << "Failed to initialize libgit2: "
+    //               << (e ? e->message : "Unknown error") << '\n';
+    //     return false;
+    // }
+
+    git_repository *repo = nullptr;
+    git_remote *remote = nullptr;
+    int result = 0;
+
+    // 打开仓库
+    if (git_repository_open(&repo, repo_path.c_str()) < 0)
+    {
+        const git_error *e = giterr_last();
+        std::cerr << "Failed to open repository: "
+                  << (e ? e->message : "Unknown error") << '\n';
+        result = -1;
+        goto cleanup;
+    }
+
+    // 检查是否已存在名为"origin"的远程
+    if (git_remote_lookup(&remote, repo, "origin") == 0)
+    {
+        std::cerr << "Remote 'origin' already exists\n";
+        git_remote_free(remote);
+        result = -1;
+        goto cleanup;
+    }
+
+    // 创建新的远程
+    if (git_remote_create(&remote, repo, "origin", url.c_str()) < 0)
+    {
+        const git_error *e = giterr_last();
+        std::cerr << "Failed to create remote: "
+                  << (e ? e->message : "Unknown error") << '\n';
+        result = -1;
+        goto cleanup;
+    }
+
+    // std::cout << "Added remote 'origin' with URL: " << url << '\n';
+
+cleanup:
+    // 清理资源
+    if (remote)
+        git_remote_free(remote);
+    if (repo)
+        git_repository_free(repo);
+    //git_libgit2_shutdown();
+
+    return result == 0;
+}
+
+// 单个远程的推送进度, 由 libgit2 回调更新
+// cancelled 置位后回调返回错误, libgit2 随即中止推送
+struct pushProgress
+{
+    std::atomic<unsigned int> current{0};
+    std::atomic<unsigned int> total{0};
+    std::atomic<size_t> bytes{0};
+    std::atomic<bool> cancelled{false};
+    std::atomic<bool> finished{false}; // 本轮推送已结束(包括因不领先而跳过)
+};
+
+int push_progress_callback(unsigned int current, unsigned int total, size_t bytes, void *payload)
+{
+    pushProgress *progress = static_cast<pushProgress *>(payload);
+    progress->current = current;
+    progress->total = total;
+    progress->bytes = bytes;
+    return progress->cancelled ? GIT_EUSER : 0;
+}
+
+// 服务器消息回调, 等待服务器处理时也能及时取消
+int push_sideband_callback(const char *str, int len, void *payload)
+{
+    (void)str;
+    (void)len;
+    return static_cast<pushProgress *>(payload)->cancelled ? GIT_EUSER : 0;
+}
+
+// git 远程操作
+
+// SSH 认证回调函数
+int credentials_callback(git_cred **cred, const char *url, const char *username_from_url,
+                         unsigned int allowed_types, void *payload)
+{
+    (void)url;
+    (void)username_from_url;
+
+    // 推送时 payload 为推送进度, 退出时已取消的推送不再认证
+    if (payload && static_cast<pushProgress *>(payload)->cancelled)
+    {
+        return GIT_EUSER;
+    }
+
+    // 只处理 SSH 代理方式
+    if (allowed_types & GIT_CREDENTIAL_SSH_KEY)
+    {
+        return git_cred_ssh_key_from_agent(cred, username_from_url);
+    }
+
+    // 可能在后台线程中调用, 不向终端输出, 由调用方根据错误码显示状态
+    return GIT_EAUTH;
+}
+
+// 远程状态缓存
+// 记录最近一次拉取时远程 master 的提交, 短时间内重启不再访问网络
+#define REMOTE_STATE_TTL 300 // 秒
+
+std::filesystem::path remote_state_path(const std::filesystem::path &repo_path)
+{
+    return repo_path / ".git" / "lab-remote-state.json";
+}
+
+void save_remote_state(const std::filesystem::path &repo_path, const git_oid *remote_head)
+{
+    nlohmann::json state;
+    state["remote_head"] = git_oid_tostr_s(remote_head);
+    state["fetched_at"] = std::time(nullptr);
+    save_json_atomic(remote_state_path(repo_path), state);
+}
+
+// 缓存未过期且本地跟踪分支仍是缓存中的远程提交时返回true
+// 跟踪分支被删除或被其他操作移动过时缓存作废, 重新拉取
+bool remote_state_fresh(git_repository *repo, const std::filesystem::path &repo_path, int ttl = REMOTE_STATE_TTL)
+{
+    std::ifstream in(remote_state_path(repo_path));
+    nlohmann::json state = nlohmann::json::parse(in, nullptr, false);
+    if (state.is_discarded() || !state.contains("fetched_at") || !state["fetched_at"].is_number() ||
+        !state.contains("remote_head") || !state["remote_head"].is_string())
+        return false;
+    std::time_t fetched_at = state["fetched_at"];
+    if (std::time(nullptr) - fetched_at >= ttl)
+        return false;
+
+    git_oid cached, tracking;
+    std::string remote_head = state["remote_head"];
+    return git_oid_fromstr(&cached, remote_head.c_str()) == 0 &&
+           git_reference_name_to_id(&tracking, repo, "refs/remotes/origin/master") == 0 &&
+           git_oid_equal(&cached, &tracking);
+}
+
+// 用本地跟踪分支计算领先/落后的提交数, 不访问网络
+// 返回false表示还没有跟踪分支(从未推送或拉取)
+bool git_ahead_behind(git_repository *repo, size_t &ahead, size_t &behind,
+                      const std::string &remote_name = "origin")
+{
+    git_oid local_id, remote_id;
+    std::string tracking = "refs/remotes/" + remote_name + "/master";
+    ahead = behind = 0;
+    if (git_reference_name_to_id(&local_id, repo, "refs/heads/master") < 0 ||
+        git_reference_name_to_id(&remote_id, repo, tracking.c_str()) < 0)
+        return false;
+    return git_graph_ahead_behind(&ahead, &behind, repo, &local_id, &remote_id) == 0;
+}
+
+bool git_ahead_behind(const std::string &repo_path, size_t &ahead, size_t &behind)
+{
+    git_repository *repo = nullptr;
+    if (git_repository_open(&repo, repo_path.c_str()) < 0)
+        return false;
+    bool ok = git_ahead_behind(repo, ahead, behind);
+    git_repository_free(repo);
+    return ok;
+}
+
+// 推送目标(student.json 的 remotes 列表, 缺省时为 git 字段对应的 origin)
+struct remoteTarget
+{
+    std::string name;
+    std::string url;
+};
+
+std::vector<remoteTarget> student_remotes(const nlohmann::json &student)
+{
+    std::vector<remoteTarget> remotes;
+    if (student.contains("remotes") && student["remotes"].is_array())
+    {
+        for (const auto &item : student["remotes"])
+        {
+            if (item.contains("name") && item["name"].is_string() && item.contains("url") && item["url"].is_string())
+                remotes.push_back({item["name"], item["url"]});
+        }
+    }
+    if (remotes.empty() && student.contains("git") && student["git"].is_string())
+    {
+        remotes.push_back({"origin", student["git"]});
+    }
+    return remotes;
+}
+
+
+// git push
+// 返回值: <0 出错(网络或SSH代理不可用等), 0 成功
+// 出错时不再退出程序, 由推送队列稍后重试
+int use_git_push(const std::string &repo_path, const std::string &url,
+                 const std::string &remote_name = "origin", pushProgress *progress = nullptr)
+{
+    TRACE_SPAN("use_git_push", "git");
+    //git_libgit2_init();
+
+    git_repository *repo = nullptr;
+    git_remote *remote = nullptr;
+    git_reference *local_ref = nullptr;
+    git_push_options push_options;
+    git_remote_callbacks callbacks = GIT_REMOTE_CALLBACKS_INIT;
+    std::string upstream = remote_name + "/master";
+
+    // 设置 refspecs（本地 master 推送到远程 master）
+    const char *refspec = "refs/heads/master:refs/heads/master";
+    const git_strarray refspecs = {
+        (char **)&refspec,
+        1};
+
+    size_t ahead = 0, behind = 0;
+    int error = git_repository_open(&repo, repo_path.c_str());
+    if (error < 0)
+        goto cleanup;
+
+    // 本地没有领先于远程的提交时无需连接
+    if (git_ahead_behind(repo, ahead, behind, remote_name) && ahead == 0)
+        goto cleanup;
+
+    // 获取或创建 remote
+    error = git_remote_lookup(&remote, repo, remote_name.c_str());
+    if (error < 0)
+    {
+        error = git_remote_create(&remote, repo, remote_name.c_str(), url.c_str());
+        if (error < 0)
+            goto cleanup;
+    }
+
+    // 设置 push 选项和回调
+    git_push_options_init(&push_options, GIT_PUSH_OPTIONS_VERSION);
+    callbacks.credentials = credentials_callback;
+    if (progress)
+    {
+        callbacks.push_transfer_progress = push_progress_callback;
+        callbacks.sideband_progress = push_sideband_callback;
+        callbacks.payload = progress;
+    }
+    push_options.callbacks = callbacks;
+
+    // 执行 push（包含自动连接）
+    error = git_remote_push(remote, &refspecs, &push_options);
+    if (error < 0 || remote_name != "origin")
+        goto cleanup;
+
+    // 设置 upstream 分支(只跟踪 origin)
+    error = git_branch_lookup(&local_ref, repo, "master", GIT_BRANCH_LOCAL);
+    if (error < 0)
+        goto cleanup;
+
+    error = git_branch_set_upstream(local_ref, upstream.c_str());
+
+cleanup:
+    git_reference_free(local_ref);
+    git_remote_free(remote);
+    git_repository_free(repo);
+    //git_libgit2_shutdown();
+
+    return error < 0 ? error : 0;
+}
+
+// 同时推送到所有远程, 每个远程使用独立的仓库对象和连接
+// 全部完成(成功或失败)后才返回, 总耗时取决于最慢的远程
+struct pushResult
+{
+    std::string name;
+    int error = 0;
+    size_t bytes = 0;
+    double elapsedMs = 0;
+};
+
+// 先依次创建缺少的远程: git_remote_create 要锁 .git/config, 并发创建会返回 GIT_ELOCKED
+void create_missing_remotes(const std::string &repo_path, const std::vector<remoteTarget> &remotes)
+{
+    git_repository *repo = nullptr;
+    if (git_repository_open(&repo, repo_path.c_str()) < 0)
+        return;
+    for (const auto &target : remotes)
+    {
+        git_remote *remote = nullptr;
+        if (git_remote_lookup(&remote, repo, target.name.c_str()) < 0)
+            git_remote_create(&remote, repo, target.name.c_str(), target.url.c_str());
+        git_remote_free(remote);
+    }
+    git_repository_free(repo);
+}
+
+// max_parallel 限制同时进行的推送数, 0 为不限制
+std::vector<pushResult> push_all_remotes(const std::string &repo_path,
+                                         const std::vector<remoteTarget> &remotes,
+                                         std::vector<pushProgress> *progress = nullptr,
+                                         size_t max_parallel = 0)
+{
+    std::vector<pushResult> results(remotes.size());
+    std::vector<std::thread> workers;
+    std::atomic<size_t> next(0);
+    create_missing_remotes(repo_path, remotes);
+    size_t count = max_parallel == 0 ? remotes.size() : std::min(max_parallel, remotes.size());
+    for (size_t t = 0; t < count; ++t)
+    {
+        workers.emplace_back([&]()
+                             {
+                                 size_t i;
+                                 while ((i = next++) < remotes.size())
+                                 {
+                                     auto begin = std::chrono::steady_clock::now();
+                                     pushProgress local;
+                                     pushProgress *p = progress ? &(*progress)[i] : &local;
+                                     results[i].name = remotes[i].name;
+                                     results[i].error = use_git_push(repo_path, remotes[i].url, remotes[i].name, p);
+                                     results[i].bytes = p->bytes;
+                                     p->finished = true;
+                                     results[i].elapsedMs = std::chrono::duration<double, std::milli>(
+                                                                std::chrono::steady_clock::now() - begin)
+                                                                .count();
+                                 }
+                             });
+    }
+    for (auto &worker : workers)
+        worker.join();
+    return results;
+}
+
+// 推送日志: 每次请求推送追加一行 "push <时间> <HEAD>", 推送成功后清空
+// 多条记录合并为一次推送(总是推送最新的 master)
+std::filesystem::path push_journal_path(const std::filesystem::path &repo_path)
+{
+    return repo_path / ".git" / "lab-push.journal";
+}
+
+bool push_journal_append(const std::filesystem::path &repo_path)
+{
+    std::string head = "unborn";
+    git_repository *repo = nullptr;
+    git_oid head_id;
+    if (git_repository_open(&repo, repo_path.c_str()) == 0)
+    {
+        if (git_reference_name_to_id(&head_id, repo, "HEAD") == 0)
+            head = git_oid_tostr_s(&head_id);
+        git_repository_free(repo);
+    }
+
+    std::string line = "push " + std::to_string(std::time(nullptr)) + " " + head + "\n";
+    int fd = open(push_journal_path(repo_path).c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0)
+        return false;
+    bool ok = write(fd, line.data(), line.size()) == (ssize_t)line.size();
+    ok = fsync(fd) == 0 && ok;
+    close(fd);
+    return ok;
+}
+
+bool push_journal_pending(const std::filesystem::path &repo_path)
+{
+    std::error_code ec;
+    auto size = std::filesystem::file_size(push_journal_path(repo_path), ec);
+    return !ec && size > 0;
+}
+
+// 推送队列
+// 后台线程按指数退避重试, 网络不可用时界面不会阻塞或退出
+#define PUSH_RETRY_MIN_MS 1000
+#define PUSH_RETRY_MAX_MS 300000
+
+class pushQueue
+{
+private:
+    std::filesystem::path repoPath;
+    std::vector<remoteTarget> remotes;
+    std::vector<pushProgress> progress;
+    std::thread worker;
+    std::mutex mtx;
+    std::condition_variable cv;
+    bool stopping;
+    bool started;
+    bool running; // 后台线程尚未退出
+    unsigned long requested; // 请求推送次数
+    unsigned long pushed;    // 已完成推送时对应的请求次数
+    int failures;
+    std::string state;
+
+    void drain()
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        while (!stopping)
+        {
+            if (pushed == requested)
+            {
+                cv.wait(lock, [this]
+                        { return stopping || pushed != requested; });
+                continue;
+            }
+
+            // 推送期间新增的请求会在下一轮合并推送
+            unsigned long target = requested;
+            state = "pushing";
+            for (auto &p : progress)
+            {
+                p.current = 0;
+                p.total = 0;
+                p.finished = false;
+            }
+            lock.unlock();
+            // 已推送成功的远程会因不再领先而直接跳过
+            std::vector<pushResult> results = push_all_remotes(repoPath.string(), remotes, &progress);
+            lock.lock();
+
+            std::string failed;
+            for (const auto &result : results)
+            {
+                if (result.error < 0)
+                    failed += (failed.empty() ? "" : ",") + result.name;
+            }
+
+            if (failed.empty())
+            {
+                pushed = target;
+                failures = 0;
+                if (pushed == requested)
+                {
+                    std::error_code ec;
+                    std::filesystem::remove(push_journal_path(repoPath), ec);
+                    state = "ok";
+                }
+                cv.notify_all();
+                continue;
+            }
+
+            failures++;
+            long delay = PUSH_RETRY_MIN_MS;
+            for (int i = 1; i < failures && delay < PUSH_RETRY_MAX_MS; i++)
+                delay *= 2;
+            delay = std::min(delay, (long)PUSH_RETRY_MAX_MS);
+            state = "retry " + std::to_string(delay / 1000) + "s " + failed;
+            cv.notify_all();
+            cv.wait_for(lock, std::chrono::milliseconds(delay), [this]
+                        { return stopping; });
+        }
+        running = false;
+        cv.notify_all();
+    }
+
+public:
+    pushQueue(const std::filesystem::path &repo_path, const std::vector<remoteTarget> &targets)
+        : repoPath(repo_path), remotes(targets), progress(targets.size()), stopping(false), started(false),
+          running(false), requested(0), pushed(0), failures(0)
+    {
+        // 上次未完成的推送(包括首次初始化)从日志恢复
+        if (push_journal_pending(repoPath))
+        {
+            requested = 1;
+            state = "queued";
+        }
+    }
+
+    ~pushQueue()
+    {
+        stop(-1);
+    }
+
+    // 停止后台线程并取消进行中的推送, 最多等待 timeout_ms 毫秒(<0 为一直等待)
+    // 连接阶段卡住的推送无法通过回调取消, 超时后放开线程并返回false,
+    // 此时对象必须保留到进程退出; 日志已落盘, 下次启动继续推送
+    bool stop(int timeout_ms)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        stopping = true;
+        for (auto &p : progress)
+            p.cancelled = true;
+        cv.notify_all();
+        bool exited = true;
+        if (timeout_ms < 0)
+            cv.wait(lock, [this]
+                    { return !running; });
+        else
+            exited = cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this]
+                                 { return !running; });
+        lock.unlock();
+        if (!worker.joinable())
+            return true;
+        if (exited)
+            worker.join();
+        else
+            worker.detach();
+        return exited;
+    }
+
+    // 启动后台线程(等启动拉取结束后再调用)
+    void start()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!started && !stopping)
+        {
+            started = true;
+            running = true;
+            worker = std::thread(&pushQueue::drain, this);
+        }
+    }
+
+    // 请求推送当前HEAD, 先写入日志再通知后台线程
+    void enqueue()
+    {
+        push_journal_append(repoPath);
+        std::lock_guard<std::mutex> lock(mtx);
+        requested++;
+        state = "queued";
+        cv.notify_all();
+    }
+
+    // 最多等待 timeout_ms 毫秒, 返回队列是否已清空
+    bool flush(int timeout_ms)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        return cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this]
+                           { return pushed == requested; });
+    }
+
+    bool busy()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        return pushed != requested;
+    }
+
+    std::string status()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (state != "pushing" || remotes.size() < 2)
+            return state;
+        // 多个远程时显示已完成的数量
+        size_t done = 0;
+        for (const auto &p : progress)
+        {
+            if (p.finished)
+                done++;
+        }
+        return "pushing " + std::to_string(done) + "/" + std::to_string(remotes.size());
+    }
+};
+
+// 只拉取 master 分支, depth>0 时为浅拉取
+int git_fetch_master(git_remote *remote, int depth)
+{
+    TRACE_SPAN("git_fetch_master", "git");
+    git_fetch_options fetch_options = GIT_FETCH_OPTIONS_INIT;
+    git_remote_callbacks callbacks = GIT_REMOTE_CALLBACKS_INIT;
+    callbacks.credentials = credentials_callback;
+    fetch_options.callbacks = callbacks;
+    fetch_options.depth = depth;
+
+    const char *refspec = "+refs/heads/master:refs/remotes/origin/master";
+    const git_strarray refspecs = {
+        (char **)&refspec,
+        1};
+
+    return git_remote_fetch(remote, &refspecs, &fetch_options, "fetch");
+}
+
+// 浅仓库按需补全历史(需要合并基础或翻阅历史时调用)
+int git_unshallow(git_repository *repo)
+{
+    if (git_repository_is_shallow(repo) != 1)
+    {
+        return 0;
+    }
+
+    git_remote *remote = nullptr;
+    int error = git_remote_lookup(&remote, repo, "origin");
+    if (error < 0)
+    {
+        return error;
+    }
+    error = git_fetch_master(remote, GIT_FETCH_DEPTH_UNSHALLOW);
+    git_remote_free(remote);
+    return error;
+}
+
+// 拉取选项(来自 student.json: fetch_depth, pull_rebase)
+struct pullOptions
+{
+    int depth = PULL_FETCH_DEPTH; // 浅拉取深度(只用于新仓库或浅仓库)
+    bool rebase = false;          // 历史分叉时在内存中变基, 而不是生成合并提交
+};
+
+// 把当前分支移动到指定提交, 只检出与当前HEAD不同的文件
+int git_move_head_to(git_repository *repo, git_reference *local_ref, const git_oid *target, const char *log_message)
+{
+    git_object *target_commit = nullptr;
+    git_reference *new_ref = nullptr;
+    git_checkout_options checkout_options = GIT_CHECKOUT_OPTIONS_INIT;
+    checkout_options.checkout_strategy = GIT_CHECKOUT_SAFE;
+
+    int error = git_object_lookup(&target_commit, repo, target, GIT_OBJECT_COMMIT);
+    if (error < 0)
+        return error;
+
+    error = git_checkout_tree(repo, target_commit, &checkout_options);
+    if (error >= 0)
+    {
+        // 本地分支尚无提交时直接创建 master
+        if (local_ref)
+            error = git_reference_set_target(&new_ref, local_ref, target, log_message);
+        else
+            error = git_reference_create(&new_ref, repo, "refs/heads/master", target, 0, log_message);
+    }
+
+    git_reference_free(new_ref);
+    git_object_free(target_commit);
+    return error;
+}
+
+// 在内存中把本地提交变基到远程提交之上, 成功后移动分支
+int git_rebase_onto_remote(git_repository *repo, git_reference *local_ref,
+                           git_annotated_commit *upstream, git_signature *signature)
+{
+    git_rebase *rebase = nullptr;
+    git_rebase_operation *operation = nullptr;
+    git_index *index = nullptr;
+    git_rebase_options rebase_options = GIT_REBASE_OPTIONS_INIT;
+    rebase_options.inmemory = 1;
+    git_oid last_id = *git_annotated_commit_id(upstream);
+    git_oid rebased_id;
+
+    int error = git_rebase_init(&rebase, repo, nullptr, upstream, nullptr, &rebase_options);
+    if (error < 0)
+        return error;
+
+    while ((error = git_rebase_next(&operation, rebase)) == 0)
+    {
+        error = git_rebase_inmemory_index(&index, rebase);
+        if (error < 0)
+            break;
+        bool has_conflicts = git_index_has_conflicts(index);
+        git_index_free(index);
+        index = nullptr;
+        if (has_conflicts)
+        {
+            error = GIT_ECONFLICT;
+            break;
+        }
+
+        error = git_rebase_commit(&rebased_id, rebase, nullptr, signature, nullptr, nullptr);
+        if (error == GIT_EAPPLIED)
+        {
+            // 该提交已在远程中, 跳过
+            continue;
+        }
+        if (error < 0)
+            break;
+        last_id = rebased_id;
+    }
+
+    if (error == GIT_ITEROVER)
+    {
+        error = git_rebase_finish(rebase, signature);
+        if (error >= 0)
+            error = git_move_head_to(repo, local_ref, &last_id, "pull: rebase onto origin/master");
+    }
+    else
+    {
+        git_rebase_abort(rebase);
+    }
+
+    git_rebase_free(rebase);
+    return error;
+}
+
+// 合并冲突时放弃合并
+// 把合并改动过的文件恢复为HEAD版本并清除 MERGING 状态;
+// 合并前这些文件都是干净的(GIT_CHECKOUT_SAFE), 其他未提交的修改保留
+int git_abort_merge(git_repository *repo)
+{
+    git_index *index = nullptr;
+    git_object *head_tree = nullptr;
+    git_diff *diff = nullptr;
+    std::unordered_set<std::string> changed;
+    std::vector<char *> paths;
+    git_checkout_options checkout_options = GIT_CHECKOUT_OPTIONS_INIT;
+
+    int error = git_repository_index(&index, repo);
+    if (error < 0)
+        goto cleanup;
+    error = git_revparse_single(&head_tree, repo, "HEAD^{tree}");
+    if (error < 0)
+        goto cleanup;
+
+    // 冲突条目和与HEAD不同的条目都是合并写入的
+    for (size_t i = 0; i < git_index_entrycount(index); ++i)
+    {
+        const git_index_entry *entry = git_index_get_byindex(index, i);
+        if (GIT_INDEX_ENTRY_STAGE(entry) != 0)
+            changed.insert(entry->path);
+    }
+    error = git_diff_tree_to_index(&diff, repo, (git_tree *)head_tree, index, nullptr);
+    if (error < 0)
+        goto cleanup;
+    for (size_t i = 0; i < git_diff_num_deltas(diff); ++i)
+    {
+        const git_diff_delta *delta = git_diff_get_delta(diff, i);
+        changed.insert(delta->old_file.path);
+        changed.insert(delta->new_file.path);
+    }
+
+    // 索引恢复为HEAD, 再只强制检出这些文件(合并新增的文件一并删除)
+    error = git_index_read_tree(index, (git_tree *)head_tree);
+    if (error >= 0)
+        error = git_index_write(index);
+    if (error < 0)
+        goto cleanup;
+    for (const auto &path : changed)
+        paths.push_back(const_cast<char *>(path.c_str()));
+    if (!paths.empty())
+    {
+        checkout_options.checkout_strategy = GIT_CHECKOUT_FORCE | GIT_CHECKOUT_REMOVE_UNTRACKED |
+                                             GIT_CHECKOUT_DISABLE_PATHSPEC_MATCH;
+        checkout_options.paths.strings = paths.data();
+        checkout_options.paths.count = paths.size();
+        error = git_checkout_head(repo, &checkout_options);
+    }
+
+cleanup:
+    git_repository_state_cleanup(repo);
+    git_diff_free(diff);
+    git_object_free(head_tree);
+    git_index_free(index);
+    return error;
+}
+
+// git pull
+// 返回值: <0 出错(GIT_ECONFLICT 表示有冲突, 合并已放弃), 0 已是最新, 1 拉取到了新提交
+// 可能在后台线程中运行, 因此出错时只返回错误码而不退出
+int use_git_pull(std::string &repo_path, const pullOptions &options = pullOptions())
+{
+    TRACE_SPAN("use_git_pull", "git");
+    git_libgit2_init();
+
+    git_repository *repo = nullptr;
+    git_remote *remote = nullptr;
+    git_reference *remote_ref = nullptr;
+    git_reference *local_ref = nullptr;
+    git_annotated_commit *annotated_commit = nullptr;
+    git_tree *tree = nullptr;
+    git_signature *signature = nullptr;
+    git_commit *local_commit = nullptr;
+    git_commit *remote_commit = nullptr;
+    git_index *index = nullptr;
+    git_merge_analysis_t analysis;
+    git_merge_preference_t preference;
+    git_checkout_options checkout_options = GIT_CHECKOUT_OPTIONS_INIT;
+    git_merge_options merge_options = GIT_MERGE_OPTIONS_INIT;
+    git_oid new_commit_id;
+    git_commit *parents[2] = {nullptr, nullptr};
+    bool fetched = false;
+    int result = 0;
+
+    int error = git_repository_open(&repo, repo_path.c_str());
+    if (error < 0)
+        goto cleanup;
+
+    // 获取远程
+    error = git_remote_lookup(&remote, repo, "origin");
+    if (error < 0)
+        goto cleanup;
+
+    // 从远程获取 master 的最新提交, 缓存未过期时跳过网络
+    // 只有新仓库或已是浅仓库时才浅拉取; 对完整仓库浅拉取会把远程提交嫁接成没有父提交,
+    // 合并分析找不到共同祖先, 快进会被误判为需要合并
+    fetched = !remote_state_fresh(repo, repo_path);
+    if (fetched)
+    {
+        int depth = 0;
+        if (git_repository_head_unborn(repo) == 1 || git_repository_is_shallow(repo) == 1)
+            depth = options.depth;
+        error = git_fetch_master(remote, depth);
+        if (error < 0)
+            goto cleanup;
+    }
+
+    // 获取远程分支引用
+    error = git_branch_lookup(&remote_ref, repo, "origin/master", GIT_BRANCH_REMOTE);
+    if (error < 0)
+        goto cleanup;
+    if (fetched)
+        save_remote_state(repo_path, git_reference_target(remote_ref));
+
+    // 获取注释提交
+    error = git_annotated_commit_from_ref(&annotated_commit, repo, remote_ref);
+    if (error < 0)
+        goto cleanup;
+
+    // 检查是否需要合并
+    error = git_merge_analysis(&analysis, &preference, repo,
+                               (const git_annotated_commit **)&annotated_commit, 1);
+    if (error < 0 || (analysis & GIT_MERGE_ANALYSIS_UP_TO_DATE))
+        goto cleanup;
+
+    // 本地分支尚无提交: 直接指向远程提交
+    if (analysis & GIT_MERGE_ANALYSIS_UNBORN)
+    {
+        error = git_move_head_to(repo, nullptr, git_annotated_commit_id(annotated_commit),
+                                 "pull: initial checkout");
+        result = 1;
+        goto cleanup;
+    }
+
+    // 获取本地当前分支引用
+    error = git_repository_head(&local_ref, repo);
+    if (error < 0)
+        goto cleanup;
+
+    // 快进: 只移动分支引用并检出变化的文件, 不产生合并提交
+    if (analysis & GIT_MERGE_ANALYSIS_FASTFORWARD)
+    {
+        error = git_move_head_to(repo, local_ref, git_annotated_commit_id(annotated_commit),
+                                 "pull: fast-forward");
+        result = 1;
+        goto cleanup;
+    }
+
+    // 历史分叉时合并需要共同祖先, 浅仓库先补全历史,
+    // 之后重新分析: 浅历史中看不到共同祖先时, 快进也会被判为需要合并
+    if (git_repository_is_shallow(repo) == 1)
+    {
+        error = git_unshallow(repo);
+        if (error < 0)
+            goto cleanup;
+        error = git_merge_analysis(&analysis, &preference, repo,
+                                   (const git_annotated_commit **)&annotated_commit, 1);
+        if (error < 0 || (analysis & GIT_MERGE_ANALYSIS_UP_TO_DATE))
+            goto cleanup;
+        if (analysis & GIT_MERGE_ANALYSIS_FASTFORWARD)
+        {
+            error = git_move_head_to(repo, local_ref, git_annotated_commit_id(annotated_commit),
+                                     "pull: fast-forward");
+            result = 1;
+            goto cleanup;
+        }
+    }
+
+    error = git_signature_default(&signature, repo);
+    if (error < 0)
+        goto cleanup;
+
+    // 可选: 在内存中变基, 保持线性历史
+    if (options.rebase)
+    {
+        error = git_rebase_onto_remote(repo, local_ref, annotated_commit, signature);
+        result = 1;
+        goto cleanup;
+    }
+
+    // 设置合并和检出选项
+    checkout_options.checkout_strategy = GIT_CHECKOUT_SAFE | GIT_CHECKOUT_RECREATE_MISSING;
+
+    // 执行合并
+    error = git_merge(repo, (const git_annotated_commit **)&annotated_commit, 1,
+                      &merge_options, &checkout_options);
+    if (error < 0)
+        goto cleanup;
+
+    // 检查索引是否有未解决的冲突
+    error = git_repository_index(&index, repo);
+    if (error < 0)
+        goto cleanup;
+    if (git_index_has_conflicts(index))
+    {
+        // 不把冲突标记留在工作区, 也不让仓库停在 MERGING 状态
+        git_index_free(index);
+        index = nullptr;
+        git_abort_merge(repo);
+        error = GIT_ECONFLICT;
+        goto cleanup;
+    }
+
+    // 创建合并提交
+    error = git_index_write_tree(&new_commit_id, index);
+    if (error < 0)
+        goto cleanup;
+
+    error = git_tree_lookup(&tree, repo, &new_commit_id);
+    if (error < 0)
+        goto cleanup;
+
+    error = git_reference_peel((git_object **)&local_commit, local_ref, GIT_OBJ_COMMIT);
+    if (error < 0)
+        goto cleanup;
+
+    error = git_reference_peel((git_object **)&remote_commit, remote_ref, GIT_OBJ_COMMIT);
+    if (error < 0)
+        goto cleanup;
+
+    parents[0] = local_commit;
+    parents[1] = remote_commit;
+    error = git_commit_create(&new_commit_id, repo, "HEAD", signature, signature,
+                              NULL, "Merge branch 'origin/master'", tree,
+                              2, (const git_commit **)parents);
+    if (error < 0)
+        goto cleanup;
+
+    git_repository_state_cleanup(repo);
+    result = 1;
+
+cleanup:
+    // 清理资源
+    git_index_free(index);
+    git_tree_free(tree);
+    git_signature_free(signature);
+    git_commit_free(local_commit);
+    git_commit_free(remote_commit);
+    git_annotated_commit_free(annotated_commit);
+    git_reference_free(remote_ref);
+    git_reference_free(local_ref);
+    git_remote_free(remote);
+    git_repository_free(repo);
+    git_libgit2_shutdown();
+
+    return error < 0 ? error : result;
+}
+
+// 后台拉取
+// 启动时不再阻塞界面, 拉取到新提交后由主循环刷新面板
+class asyncPull
+{
+private:
+    std::thread worker;
+    std::atomic<bool> finished;
+    std::atomic<bool> updated;
+    std::atomic<int> result;
+
+public:
+    asyncPull(const std::string &repo_path, const pullOptions &options)
+        : finished(false), updated(false), result(0)
+    {
+        worker = std::thread([this, repo_path, options]()
+                             {
+                                 std::string path = repo_path;
+                                 int r = use_git_pull(path, options);
+                                 result = r;
+                                 updated = r > 0;
+                                 finished = true;
+                             });
+    }
+
+    ~asyncPull()
+    {
+        wait();
+    }
+
+    // 等待拉取结束(提交或推送前调用, 避免与合并同时写仓库)
+    void wait()
+    {
+        if (worker.joinable())
+            worker.join();
+    }
+
+    bool isFinished() const
+    {
+        return finished;
+    }
+
+    // 取出"有新提交"标记, 每次更新只返回一次true
+    bool takeUpdate()
+    {
+        return updated.exchange(false);
+    }
+
+    int status() const
+    {
+        return result;
+    }
+};
+
+// 仓库维护
+// 松散对象超过阈值时打包, 删除已打包的松散文件并写入多包索引
+#define LOOSE_OBJECT_THRESHOLD 512 // 触发打包的松散对象数量
+#define MAINTENANCE_IDLE_MS 30000  // 无按键多久视为空闲
+
+struct maintenanceReport
+{
+    size_t looseObjects = 0; // 维护前的松散对象数
+    size_t packed = 0;       // 写入新包的对象数
+    size_t pruned = 0;       // 删除的松散文件数
+    bool multiPackIndex = false;
+    double elapsedMs = 0;
+    int error = 0;
+};
+
+// 列出 .git/objects/xx/yyyy 形式的松散对象
+std::vector<git_oid> list_loose_objects(const std::filesystem::path &objects_dir)
+{
+    std::vector<git_oid> oids;
+    std::error_code ec;
+    for (const auto &dir : std::filesystem::directory_iterator(objects_dir, ec))
+    {
+        std::string prefix = dir.path().filename().string();
+        if (prefix.size() != 2 || !isxdigit(prefix[0]) || !isxdigit(prefix[1]) || !dir.is_directory())
+            continue;
+        for (const auto &file : std::filesystem::directory_iterator(dir.path(), ec))
+        {
+            std::string hex = prefix + file.path().filename().string();
+            git_oid oid;
+            if (hex.size() == 40 && git_oid_fromstr(&oid, hex.c_str()) == 0)
+                oids.push_back(oid);
+        }
+    }
+    return oids;
+}
+
+// 记录维护耗时, 便于分析仓库变慢的原因
+void log_maintenance(const std::filesystem::path &repo_path, const maintenanceReport &report)
+{
+    std::ofstream log(repo_path / ".git" / "lab-maintenance.log", std::ios::app);
+    log << std::time(nullptr)
+        << " loose=" << report.looseObjects
+        << " packed=" << report.packed
+        << " pruned=" << report.pruned
+        << " midx=" << report.multiPackIndex
+        << " error=" << report.error
+        << " ms=" << report.elapsedMs << '\n';
+}
+
+maintenanceReport git_maintenance(const std::filesystem::path &repo_path,
+                                  size_t threshold = LOOSE_OBJECT_THRESHOLD)
+{
+    TRACE_SPAN("git_maintenance", "git");
+    maintenanceReport report;
+    auto begin = std::chrono::steady_clock::now();
+    std::filesystem::path objects_dir = repo_path / ".git" / "objects";
+    std::vector<git_oid> loose = list_loose_objects(objects_dir);
+    report.looseObjects = loose.size();
+    if (loose.size() < threshold)
+        return report;
+
+    git_repository *repo = nullptr;
+    git_packbuilder *packbuilder = nullptr;
+    git_odb *odb = nullptr;
+
+    int error = git_repository_open(&repo, repo_path.c_str());
+    if (error < 0)
+        goto cleanup;
+
+    // 只打包当前的松散对象, 打包成功后这些文件即可安全删除
+    error = git_packbuilder_new(&packbuilder, repo);
+    if (error < 0)
+        goto cleanup;
+    for (const auto &oid : loose)
+    {
+        error = git_packbuilder_insert(packbuilder, &oid, nullptr);
+        if (error < 0)
+            goto cleanup;
+    }
+    error = git_packbuilder_write(packbuilder, nullptr, 0, nullptr, nullptr);
+    if (error < 0)
+        goto cleanup;
+    report.packed = git_packbuilder_object_count(packbuilder);
+
+    error = git_repository_odb(&odb, repo);
+    if (error < 0)
+        goto cleanup;
+    git_odb_refresh(odb);
+
+    // 删除已进入新包的松散文件
+    for (const auto &oid : loose)
+    {
+        char hex[GIT_OID_HEXSZ + 1];
+        git_oid_tostr(hex, sizeof(hex), &oid);
+        std::error_code ec;
+        std::filesystem::path dir = objects_dir / std::string(hex, 2);
+        if (std::filesystem::remove(dir / (hex + 2), ec))
+            report.pruned++;
+        if (std::filesystem::is_empty(dir, ec))
+            std::filesystem::remove(dir, ec);
+    }
+
+    report.multiPackIndex = git_odb_write_multi_pack_index(odb) == 0;
+
+cleanup:
+    git_odb_free(odb);
+    git_packbuilder_free(packbuilder);
+    git_repository_free(repo);
+
+    report.error = error < 0 ? error : 0;
+    report.elapsedMs = std::chrono::duration<double, std::milli>(
+                           std::chrono::steady_clock::now() - begin)
+                           .count();
+    log_maintenance(repo_path, report);
+    return report;
+}
+
+// student.json 中可用 fetch_depth / pull_rebase 配置拉取方式
+pullOptions load_pull_options(const std::filesystem::path &workDir)
+{
+    pullOptions options;
+    std::ifstream config(workDir / "student.json");
+    nlohmann::json local = nlohmann::json::parse(config, nullptr, false);
+    if (!local.is_discarded() && local.contains("fetch_depth") && local["fetch_depth"].is_number_integer())
+    {
+        options.depth = local["fetch_depth"];
+    }
+    if (!local.is_discarded() && local.contains("pull_rebase") && local["pull_rebase"].is_boolean())
+    {
+        options.rebase = local["pull_rebase"];
+    }
+    return options;
+}
+
+// 索引相对HEAD的变化数, 出错返回-1
+int git_staged_changes(const std::string &repo_path)
+{
+    git_repository *repo = nullptr;
+    git_index *index = nullptr;
+    git_object *head_tree = nullptr;
+    git_diff *diff = nullptr;
+    int changes = -1;
+    if (git_repository_open(&repo, repo_path.c_str()) == 0 &&
+        git_repository_index(&index, repo) == 0)
+    {
+        // 未提交过时与空树比较
+        git_revparse_single(&head_tree, repo, "HEAD^{tree}");
+        if (git_diff_tree_to_index(&diff, repo, (git_tree *)head_tree, index, nullptr) == 0)
+            changes = git_diff_num_deltas(diff);
+    }
+    git_diff_free(diff);
+    git_object_free(head_tree);
+    git_index_free(index);
+    git_repository_free(repo);
+    return changes;
+}
+
+// 固定线程数的任务池
+class taskPool
+{
+private:
+    std::vector<std::thread> threads;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mtx;
+    std::condition_variable cv;
+    bool stopping;
+
+public:
+    taskPool(size_t count)
+        : stopping(false)
+    {
+        for (size_t i = 0; i < std::max<size_t>(1, count); ++i)
+        {
+            threads.emplace_back([this]()
+                                 {
+                                     std::unique_lock<std::mutex> lock(mtx);
+                                     while (true)
+                                     {
+                                         cv.wait(lock, [this]
+                                                 { return stopping || !tasks.empty(); });
+                                         if (tasks.empty())
+                                             return;
+                                         std::function<void()> task = std::move(tasks.front());
+                                         tasks.pop_front();
+                                         lock.unlock();
+                                         task();
+                                         lock.lock();
+                                     } });
+        }
+    }
+
+    // 执行完已提交的任务后退出
+    ~taskPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+        }
+        cv.notify_all();
+        for (auto &thread : threads)
+            thread.join();
+    }
+
+    void post(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            tasks.push_back(std::move(task));
+        }
+        cv.notify_one();
+    }
+};
+
+// 批处理
+// 每个仓库依次经过 拉取 -> ShellCheck -> 暂存提交 -> 推送,
+// 拉取和推送在网络线程池中进行, 检查和提交在CPU线程池中进行, 不同仓库的阶段互相重叠
+#define BATCH_NET_JOBS 8
+struct batchOptions
+{
+    std::vector<std::string> dirs;
+    std::string report = "batch-report.json";
+    size_t netJobs = BATCH_NET_JOBS;
+    size_t cpuJobs = std::max(1u, std::thread::hardware_concurrency());
+};
+
+double batch_elapsed_ms(std::chrono::steady_clock::time_point begin)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+}
+
+// 拉取阶段
+void batch_pull(const std::string &dir, nlohmann::json &report)
+{
+    auto begin = std::chrono::steady_clock::now();
+    std::string path = dir;
+    int result = use_git_pull(path, load_pull_options(dir));
+    if (result < 0)
+    {
+        // 合并中途出错时不让仓库停在 MERGING 状态, 工作区恢复为拉取前的提交
+        git_repository *repo = nullptr;
+        if (git_repository_open(&repo, dir.c_str()) == 0)
+        {
+            if (git_repository_state(repo) != GIT_REPOSITORY_STATE_NONE)
+                git_abort_merge(repo);
+            git_repository_free(repo);
+        }
+    }
+    report["pull"] = {{"status", result == GIT_ECONFLICT ? "conflict" : result < 0 ? "failed" : result > 0 ? "updated" : "up-to-date"},
+                      {"ms", batch_elapsed_ms(begin)}};
+}
+
+// 拉取失败时工作区可能不完整, 不提交也不推送
+bool batch_pull_failed(const nlohmann::json &report)
+{
+    std::string status = report["pull"]["status"];
+    return status == "failed" || status == "conflict";
+}
+
+// 检查并提交阶段
+void batch_check_commit(const std::string &dir, const nlohmann::json &student, nlohmann::json &report)
+{
+    auto begin = std::chrono::steady_clock::now();
+    nlohmann::json lint = nlohmann::json::object();
+    for (size_t i = 0; i < student["lab_dir"].size(); ++i)
+    {
+        std::string lab = student["lab_dir"][i];
+        std::string script = student.contains("lab_sh") && i < student["lab_sh"].size()
+                                 ? student["lab_sh"][i].get<std::string>()
+                                 : lab + ".sh";
+        std::filesystem::path scriptPath = std::filesystem::path(dir) / lab / script;
+        if (!std::filesystem::exists(scriptPath))
+            continue;
+        std::string output;
+        runShellCheckCached(dir, scriptPath, [&](const char *data, size_t len)
+                            { output.append(data, len); });
+        diagnosticTable diagnostics;
+        if (!diagnostics.parse(output))
+        {
+            lint[lab] = "unavailable";
+            continue;
+        }
+        nlohmann::json counts;
+        for (const char *level : {"error", "warning", "info", "style"})
+            counts[level] = diagnostics.count(level);
+        lint[lab] = counts;
+    }
+    report["lint"] = {{"labs", lint}, {"ms", batch_elapsed_ms(begin)}};
+
+    if (batch_pull_failed(report))
+    {
+        report["commit"] = {{"status", "skipped"}};
+        return;
+    }
+    begin = std::chrono::steady_clock::now();
+    std::string status = "failed";
+    if (git_add_all(dir))
+    {
+        int changes = git_staged_changes(dir);
+        char message[64];
+        std::time_t now = std::time(nullptr);
+        struct tm local;
+        localtime_r(&now, &local);
+        std::strftime(message, sizeof(message), "batch collect %Y-%m-%d %H:%M", &local);
+        if (changes == 0)
+            status = "clean";
+        else if (changes > 0 && use_git_commit(dir, message))
+            status = "committed";
+    }
+    report["commit"] = {{"status", status}, {"ms", batch_elapsed_ms(begin)}};
+}
+
+// 推送阶段
+// 在网络线程池的一个任务中依次推送各远程, 同时进行的网络连接数不超过 --net-jobs
+void batch_push(const std::string &dir, const nlohmann::json &student, nlohmann::json &report)
+{
+    nlohmann::json pushes = nlohmann::json::array();
+    if (batch_pull_failed(report))
+    {
+        report["push"] = pushes;
+        return;
+    }
+    for (const pushResult &result : push_all_remotes(dir, student_remotes(student), nullptr, 1))
+    {
+        pushes.push_back({{"remote", result.name},
+                          {"status", result.error < 0 ? "failed" : "ok"},
+                          {"bytes", result.bytes},
+                          {"ms", result.elapsedMs}});
+    }
+    report["push"] = pushes;
+}
+
+// --batch: 不进入界面, 处理多个学生仓库并写出汇总报告
+int run_batch(const batchOptions &options)
+{
+    auto begin = std::chrono::steady_clock::now();
+    std::vector<nlohmann::json> reports(options.dirs.size());
+    std::vector<nlohmann::json> students(options.dirs.size());
+    std::mutex doneMutex;
+    std::condition_variable doneCv;
+    size_t remaining = options.dirs.size();
+    auto finish = [&](size_t i)
+    {
+        const nlohmann::json &report = reports[i];
+        bool ok = report.value("error", "").empty() &&
+                  !batch_pull_failed(report) &&
+                  report["commit"]["status"] != "failed";
+        if (report.contains("push"))
+            for (const auto &push : report["push"])
+                ok = ok && push["status"] == "ok";
+        reports[i]["ok"] = ok;
+        std::lock_guard<std::mutex> lock(doneMutex);
+        std::cout << (ok ? "ok     " : "failed ") << options.dirs[i] << std::endl;
+        if (--remaining == 0)
+            doneCv.notify_all();
+    };
+
+    {
+        taskPool net(options.netJobs);
+        taskPool cpu(options.cpuJobs);
+        for (size_t i = 0; i < options.dirs.size(); ++i)
+        {
+            const std::string &dir = options.dirs[i];
+            reports[i]["dir"] = dir;
+            std::ifstream in(std::filesystem::path(dir) / "student.json");
+            students[i] = nlohmann::json::parse(in, nullptr, false);
+            if (students[i].is_discarded() || !student_labs_valid(students[i]) ||
+                !std::filesystem::exists(std::filesystem::path(dir) / ".git"))
+            {
+                reports[i]["error"] = "not a lab repository";
+                reports[i]["pull"] = {{"status", "failed"}};
+                reports[i]["commit"] = {{"status", "failed"}};
+                finish(i);
+                continue;
+            }
+            // 阶段完成后把下一阶段交给对应的线程池
+            net.post([&, i]()
+                     {
+                         batch_pull(options.dirs[i], reports[i]);
+                         cpu.post([&, i]()
+                                  {
+                                      batch_check_commit(options.dirs[i], students[i], reports[i]);
+                                      net.post([&, i]()
+                                               {
+                                                   batch_push(options.dirs[i], students[i], reports[i]);
+                                                   finish(i);
+                                               });
+                                  });
+                     });
+        }
+        std::unique_lock<std::mutex> lock(doneMutex);
+        doneCv.wait(lock, [&]
+                    { return remaining == 0; });
+    }
+
+    nlohmann::json summary;
+    summary["generated"] = std::time(nullptr);
+    summary["net_jobs"] = options.netJobs;
+    summary["cpu_jobs"] = options.cpuJobs;
+    summary["elapsed_ms"] = batch_elapsed_ms(begin);
+    summary["repos"] = reports;
+    size_t failed = std::count_if(reports.begin(), reports.end(), [](const nlohmann::json &r)
+                                  { return !r.value("ok", false); });
+    summary["failed"] = failed;
+    if (!save_json_atomic(options.report, summary))
+    {
+        std::cerr << "Error: cannot write " << options.report << std::endl;
+        return 1;
+    }
+    std::cout << options.dirs.size() - failed << "/" << options.dirs.size() << " ok, report: " << options.report << std::endl;
+    return failed == 0 ? 0 : 1;
+}
+
+// 沙箱子进程
+// 子进程在独立进程组中运行, 带CPU/内存/文件大小等rlimit, 超时后整个进程组被杀掉
+#define SANDBOX_TIMEOUT_MS 2000
+#define SANDBOX_MEMORY_MB 256
+#define SANDBOX_FILE_MB 16
+#define SANDBOX_OUTPUT_BYTES (1 << 20) // 最多收集的输出, 超过后结束进程
+#define SANDBOX_POLL_MS 10             // 检查脚本是否已退出的间隔
+#define SANDBOX_EXIT_GRACE_MS 100      // 脚本退出后继续读取输出的时间, 之后结束留下的后台进程
+struct sandboxLimits
+{
+    int timeoutMs = SANDBOX_TIMEOUT_MS;
+    rlim_t memoryMb = SANDBOX_MEMORY_MB;
+    rlim_t fileMb = SANDBOX_FILE_MB;
+    size_t outputBytes = SANDBOX_OUTPUT_BYTES;
+};
+
+// 在子进程 exec 之前调用
+void apply_sandbox_limits(const sandboxLimits &limits)
+{
+    struct rlimit limit;
+    limit.rlim_cur = limit.rlim_max = limits.timeoutMs / 1000 + 1;
+    setrlimit(RLIMIT_CPU, &limit);
+    limit.rlim_cur = limit.rlim_max = limits.memoryMb << 20;
+    setrlimit(RLIMIT_AS, &limit);
+    limit.rlim_cur = limit.rlim_max = limits.fileMb << 20;
+    setrlimit(RLIMIT_FSIZE, &limit);
+    limit.rlim_cur = limit.rlim_max = 0;
+    setrlimit(RLIMIT_CORE, &limit);
+    limit.rlim_cur = limit.rlim_max = 64;
+    setrlimit(RLIMIT_NOFILE, &limit);
+}
+
+struct sandboxResult
+{
+    int exitCode = -1;
+    bool timedOut = false;
+    bool truncated = false; // 输出超过上限
+    std::string output;     // stdout
+    std::string errors;     // stderr
+    double elapsedMs = 0;
+};
+
+// 运行 args, 标准输入来自 input_file, 工作目录为 cwd, 返回 false 表示无法启动
+bool run_sandboxed(const std::vector<std::string> &args, const std::filesystem::path &input_file,
+                   const std::filesystem::path &cwd, const sandboxLimits &limits, sandboxResult &result)
+{
+    TRACE_SPAN("sandbox", "child");
+    int out[2], err[2];
+    if (pipe2(out, O_CLOEXEC) < 0)
+        return false;
+    if (pipe2(err, O_CLOEXEC) < 0)
+    {
+        close(out[0]);
+        close(out[1]);
+        return false;
+    }
+
+    std::vector<char *> argv;
+    for (const auto &arg : args)
+        argv.push_back(const_cast<char *>(arg.c_str()));
+    argv.push_back(nullptr);
+    std::string home = "HOME=" + cwd.string();
+    char *envp[] = {const_cast<char *>("PATH=/usr/local/bin:/usr/bin:/bin"), const_cast<char *>("LANG=C.UTF-8"),
+                    const_cast<char *>(home.c_str()), nullptr};
+
+    auto begin = std::chrono::steady_clock::now();
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        setpgid(0, 0);
+        int in = open(input_file.c_str(), O_RDONLY | O_CLOEXEC);
+        if (in < 0 || chdir(cwd.c_str()) < 0)
+            _exit(127);
+        dup2(in, STDIN_FILENO);
+        if (in != STDIN_FILENO)
+            close(in);
+        dup2(out[1], STDOUT_FILENO);
+        dup2(err[1], STDERR_FILENO);
+        apply_sandbox_limits(limits);
+        execve(argv[0], argv.data(), envp);
+        _exit(127);
+    }
+    close(out[1]);
+    close(err[1]);
+    if (pid < 0)
+    {
+        close(out[0]);
+        close(err[0]);
+        return false;
+    }
+    setpgid(pid, pid);
+
+    auto deadline = begin + std::chrono::milliseconds(limits.timeoutMs);
+    struct pollfd fds[2] = {{out[0], POLLIN, 0}, {err[0], POLLIN, 0}};
+    char buf[8192];
+    int open_fds = 2;
+    bool exited = false;
+    while (open_fds > 0)
+    {
+        // 后台进程(如 sleep 100 &)会继承输出管道, 不能只等管道关闭
+        // WNOWAIT 不回收子进程, 保证结束进程组之前 pid 不会被重用
+        siginfo_t info = {};
+        if (!exited && waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) == 0 && info.si_pid == pid)
+        {
+            exited = true;
+            deadline = std::min(deadline, std::chrono::steady_clock::now() + std::chrono::milliseconds(SANDBOX_EXIT_GRACE_MS));
+        }
+        int wait = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        if (wait <= 0)
+        {
+            result.timedOut = !exited;
+            break;
+        }
+        if (poll(fds, 2, exited ? wait : std::min(wait, SANDBOX_POLL_MS)) < 0 && errno != EINTR)
+            break;
+        for (int i = 0; i < 2; ++i)
+        {
+            if (fds[i].fd < 0 || !(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+            ssize_t n = read(fds[i].fd, buf, sizeof(buf));
+            if (n > 0)
+            {
+                std::string &target = i == 0 ? result.output : result.errors;
+                target.append(buf, std::min<size_t>(n, limits.outputBytes - std::min(limits.outputBytes, target.size())));
+                result.truncated = result.truncated || target.size() >= limits.outputBytes;
+            }
+            else if (n == 0 || errno != EINTR)
+            {
+                close(fds[i].fd);
+                fds[i].fd = -1;
+                open_fds--;
+            }
+        }
+        if (result.truncated)
+            break;
+    }
+    // 脚本留下的后台进程也一并结束
+    kill(-pid, SIGKILL);
+    for (auto &fd : fds)
+        if (fd.fd >= 0)
+            close(fd.fd);
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+    result.exitCode = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    result.elapsedMs = batch_elapsed_ms(begin);
+    return true;
+}
+
+// 工作窃取调度
+// 每个线程从自己队列的尾部取任务, 自己的队列空了就从其他线程队列的头部偷
+class workStealingPool
+{
+private:
+    struct workerQueue
+    {
+        std::deque<std::function<void()>> tasks;
+        std::mutex mtx;
+    };
+    std::vector<std::unique_ptr<workerQueue>> queues;
+    size_t nextQueue;
+
+    bool take(size_t self, std::function<void()> &task)
+    {
+        {
+            workerQueue &own = *queues[self];
+            std::lock_guard<std::mutex> lock(own.mtx);
+            if (!own.tasks.empty())
+            {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+        for (size_t i = 1; i < queues.size(); ++i)
+        {
+            workerQueue &victim = *queues[(self + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mtx);
+            if (!victim.tasks.empty())
+            {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+public:
+    workStealingPool(size_t threads)
+        : nextQueue(0)
+    {
+        for (size_t i = 0; i < std::max<size_t>(1, threads); ++i)
+            queues.push_back(std::make_unique<workerQueue>());
+    }
+
+    // 在 run 之前提交, 轮流放入各线程的队列
+    void submit(std::function<void()> task)
+    {
+        queues[nextQueue++ % queues.size()]->tasks.push_back(std::move(task));
+    }
+
+    // 执行全部任务后返回
+    void run()
+    {
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < queues.size(); ++i)
+        {
+            threads.emplace_back([this, i]()
+                                 {
+                                     std::function<void()> task;
+                                     while (take(i, task))
+                                         task();
+                                 });
+        }
+        for (auto &thread : threads)
+            thread.join();
+    }
+};
+
+// 自动评分
+// 测试说明放在 Require/labN.tests.json:
+// {"timeout_ms": 2000, "memory_mb": 256,
+//  "tests": [{"name": "...", "args": [...], "stdin": "...", "stdout": "...", "exit_code": 0, "weight": 1}]}
+// 结果按 脚本内容+测试说明 的哈希缓存在报告文件旁的 lab-grade-cache/
+// (不放在学生仓库中, 被评分的脚本在仓库里运行, 可以伪造缓存)
+struct gradeOptions
+{
+    std::vector<std::string> dirs;
+    std::string specDir; // 为空时使用各仓库自己的 Require/(学生可修改, 会给出警告)
+    std::string report = "grade-report.json";
+    size_t jobs = std::max(1u, std::thread::hardware_concurrency());
+};
+
+struct gradeJob
+{
+    std::string dir;
+    std::string lab;
+    std::filesystem::path script;
+    nlohmann::json spec;
+    std::filesystem::path cacheFile;
+    std::vector<nlohmann::json> results; // 每个测试一项
+    nlohmann::json summary;              // 命中缓存时直接使用
+};
+
+// 去掉行尾空白后比较输出
+std::string trim_output(const std::string &text)
+{
+    std::string result;
+    std::istringstream in(text);
+    std::string line;
+    while (std::getline(in, line))
+    {
+        line.erase(line.find_last_not_of(" \t\r") + 1);
+        result += line + "\n";
+    }
+    while (!result.empty() && result.back() == '\n')
+        result.pop_back();
+    return result;
+}
+
+// 检查测试说明的字段类型, 在建立任务列表时调用一次
+// 线程池中的 run_grade_test 直接读取字段, 类型错误会抛出异常结束整个评分
+bool validate_grade_spec(const nlohmann::json &spec, std::string &error)
+{
+    auto positive = [&](const nlohmann::json &object, const char *key)
+    {
+        if (!object.contains(key))
+            return true;
+        if (object[key].is_number_integer() && object[key].get<long long>() > 0)
+            return true;
+        error = std::string(key) + " must be a positive integer";
+        return false;
+    };
+    auto text = [&](const nlohmann::json &object, const char *key)
+    {
+        if (!object.contains(key) || object[key].is_string())
+            return true;
+        error = std::string(key) + " must be a string";
+        return false;
+    };
+    if (!positive(spec, "timeout_ms") || !positive(spec, "memory_mb"))
+        return false;
+    for (const auto &test : spec["tests"])
+    {
+        if (!test.is_object())
+        {
+            error = "each test must be an object";
+            return false;
+        }
+        if (!text(test, "name") || !text(test, "stdin") || !text(test, "stdout"))
+            return false;
+        if (test.contains("exit_code") && !test["exit_code"].is_number_integer())
+        {
+            error = "exit_code must be an integer";
+            return false;
+        }
+        if (test.contains("weight") && !(test["weight"].is_number() && test["weight"].get<double>() >= 0))
+        {
+            error = "weight must be a non-negative number";
+            return false;
+        }
+        if (test.contains("args") && !test["args"].is_array())
+        {
+            error = "args must be an array";
+            return false;
+        }
+    }
+    return true;
+}
+
+// 缓存的结果必须和写入时的格式一致, 否则重新评分
+bool valid_grade_summary(const nlohmann::json &summary, size_t test_count)
+{
+    if (!summary.is_object() || !summary.contains("passed") || !summary["passed"].is_number_unsigned() ||
+        !summary.contains("total") || !summary["total"].is_number_unsigned() ||
+        !summary.contains("score") || !summary["score"].is_number() ||
+        !summary.contains("tests") || !summary["tests"].is_array())
+        return false;
+    if (summary["total"].get<size_t>() != test_count || summary["tests"].size() != test_count ||
+        summary["passed"].get<size_t>() > test_count)
+        return false;
+    for (const auto &result : summary["tests"])
+    {
+        if (!result.is_object() || !result.contains("status") ||
+            (result["status"] != "pass" && result["status"] != "fail"))
+            return false;
+    }
+    return true;
+}
+
+nlohmann::json run_grade_test(const gradeJob &job, const nlohmann::json &test)
+{
+    nlohmann::json result;
+    result["name"] = test.value("name", "");
+
+    sandboxLimits limits;
+    limits.timeoutMs = job.spec.value("timeout_ms", SANDBOX_TIMEOUT_MS);
+    limits.memoryMb = job.spec.value("memory_mb", SANDBOX_MEMORY_MB);
+
+    // 每个测试使用独立的临时目录
+    std::string pattern = (session_runtime_dir() / "grade-XXXXXX").string();
+    if (session_runtime_dir().empty() || !mkdtemp(&pattern[0]))
+    {
+        result["status"] = "error";
+        return result;
+    }
+    std::filesystem::path cwd = pattern;
+    {
+        std::ofstream input(cwd / ".stdin");
+        input << test.value("stdin", "");
+    }
+    std::vector<std::string> args = {"/bin/bash", std::filesystem::absolute(job.script).string()};
+    if (test.contains("args") && test["args"].is_array())
+        for (const auto &arg : test["args"])
+            args.push_back(arg.is_string() ? arg.get<std::string>() : arg.dump());
+
+    sandboxResult run;
+    bool started = run_sandboxed(args, cwd / ".stdin", cwd, limits, run);
+    std::error_code ec;
+    std::filesystem::remove_all(cwd, ec);
+
+    bool outputOk = !test.contains("stdout") || trim_output(run.output) == trim_output(test["stdout"]);
+    bool exitOk = run.exitCode == test.value("exit_code", 0);
+    result["status"] = !started ? "error" : run.timedOut ? "timeout" : run.truncated ? "output-limit" : (outputOk && exitOk) ? "pass" : "fail";
+    result["exit_code"] = run.exitCode;
+    result["ms"] = std::round(run.elapsedMs * 10) / 10;
+    if (result["status"] == "fail")
+        result["stdout"] = run.output.substr(0, 200);
+    return result;
+}
+
+// --grade: 并行评分多个学生仓库
+int run_grading(const gradeOptions &options)
+{
+    auto begin = std::chrono::steady_clock::now();
+    std::deque<gradeJob> jobs; // deque 追加时不移动已有元素
+    workStealingPool pool(options.jobs);
+    size_t testCount = 0, cachedCount = 0;
+    std::filesystem::path cacheDir = std::filesystem::absolute(options.report).parent_path() / "lab-grade-cache";
+
+    for (const auto &dir : options.dirs)
+    {
+        std::ifstream in(std::filesystem::path(dir) / "student.json");
+        nlohmann::json student = nlohmann::json::parse(in, nullptr, false);
+        if (student.is_discarded() || !student_labs_valid(student))
+        {
+            std::cerr << "Error: " << dir << " is not a lab repository." << std::endl;
+            continue;
+        }
+        for (size_t i = 0; i < student["lab_dir"].size(); ++i)
+        {
+            std::string lab = student["lab_dir"][i];
+            std::filesystem::path specDir = options.specDir.empty() ? std::filesystem::path(dir) / "Require" : std::filesystem::path(options.specDir);
+            std::string specText, scriptText;
+            std::filesystem::path script = std::filesystem::path(dir) / lab /
+                                           (student.contains("lab_sh") && i < student["lab_sh"].size() ? student["lab_sh"][i].get<std::string>() : lab + ".sh");
+            if (!read_file(specDir / (lab + ".tests.json"), specText))
+                continue;
+            nlohmann::json spec = nlohmann::json::parse(specText, nullptr, false);
+            std::string specError = "not a json object with a tests array";
+            if (spec.is_discarded() || !spec.is_object() || !spec.contains("tests") || !spec["tests"].is_array() ||
+                !validate_grade_spec(spec, specError))
+            {
+                std::cerr << "Error: invalid " << (specDir / (lab + ".tests.json")) << ": " << specError << std::endl;
+                continue;
+            }
+            if (options.specDir.empty())
+            {
+                // 仓库中的 Require/ 学生可以修改, 正式评分应使用 --spec-dir 指定教师的测试
+                std::cerr << "Warning: " << dir << " " << lab << " graded with tests from the student's own Require/" << std::endl;
+            }
+            read_file(script, scriptText);
+
+            jobs.emplace_back();
+            gradeJob &job = jobs.back();
+            job.dir = dir;
+            job.lab = lab;
+            job.script = script;
+            job.spec = spec;
+            char name[32];
+            snprintf(name, sizeof(name), "%016llx.json", (unsigned long long)fnv1a64(specText, fnv1a64(scriptText)));
+            job.cacheFile = cacheDir / name;
+            std::string cached;
+            if (read_file(job.cacheFile, cached))
+            {
+                job.summary = nlohmann::json::parse(cached, nullptr, false);
+                if (valid_grade_summary(job.summary, spec["tests"].size()))
+                {
+                    cachedCount++;
+                    continue;
+                }
+            }
+            job.summary = nullptr;
+            job.results.resize(spec["tests"].size());
+            for (size_t t = 0; t < spec["tests"].size(); ++t)
+            {
+                testCount++;
+                pool.submit([&job, t]()
+                            { job.results[t] = run_grade_test(job, job.spec["tests"][t]); });
+            }
+        }
+    }
+    pool.run();
+
+    nlohmann::json students = nlohmann::json::object();
+    for (gradeJob &job : jobs)
+    {
+        if (job.summary.is_null())
+        {
+            double earned = 0, possible = 0;
+            size_t passed = 0;
+            for (size_t t = 0; t < job.results.size(); ++t)
+            {
+                double weight = job.spec["tests"][t].value("weight", 1.0);
+                possible += weight;
+                if (job.results[t]["status"] == "pass")
+                {
+                    earned += weight;
+                    passed++;
+                }
+            }
+            job.summary["passed"] = passed;
+            job.summary["total"] = job.results.size();
+            job.summary["score"] = possible > 0 ? std::round(earned * 1000 / possible) / 10 : 0;
+            job.summary["tests"] = job.results;
+            // 只缓存全部测试都正常结束的结果, 超时或启动失败可能只是机器繁忙, 下次重新运行
+            bool complete = std::all_of(job.results.begin(), job.results.end(), [](const nlohmann::json &result)
+                                        { return result["status"] == "pass" || result["status"] == "fail"; });
+            if (complete)
+            {
+                std::error_code ec;
+                std::filesystem::create_directories(job.cacheFile.parent_path(), ec);
+                save_json_atomic(job.cacheFile, job.summary);
+            }
+        }
+        students[job.dir][job.lab] = job.summary;
+    }
+
+    for (auto &[dir, labs] : students.items())
+    {
+        std::cout << dir;
+        for (auto &[lab, summary] : labs.items())
+            std::cout << "  " << lab << " " << summary.value("passed", 0) << "/" << summary.value("total", 0);
+        std::cout << std::endl;
+    }
+
+    nlohmann::json report;
+    report["generated"] = std::time(nullptr);
+    report["jobs"] = options.jobs;
+    report["tests_run"] = testCount;
+    report["labs_cached"] = cachedCount;
+    report["elapsed_ms"] = batch_elapsed_ms(begin);
+    report["students"] = students;
+    if (!save_json_atomic(options.report, report))
+    {
+        std::cerr << "Error: cannot write " << options.report << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// 初始化
+void init(std::filesystem::path &workDir)
+{
+    TRACE_SPAN("init", "startup");
+    nlohmann::json student;
+    std::string specialization = specializationChoice();
+    student["specialization"] = specialization;
+    studentInfo(student);
+    std::string editor = editorChoice();
+    student["editor"] = editor;
+    student["lab_sh"] = {"lab1.sh", "lab2.sh", "lab3.sh", "lab4.sh"};
+    student["lab_dir"] = {"lab1", "lab2", "lab3", "lab4"};
+    student["lab1"] = nlohmann::json::array();
+    student["lab2"] = nlohmann::json::array();
+    student["lab3"] = nlohmann::json::array();
+    student["lab4"] = nlohmann::json::array();
+    std::ofstream outFile(workDir / "student.json");
+    outFile << student.dump(4);
+    outFile.close();
+    std::ofstream initFile(workDir / "README.md");
+    initFile.close();
+    for (int i = 0; i < student["lab_dir"].size(); i++)
+    {
+        std::filesystem::create_directories(workDir / student["lab_dir"][i]);
+        std::ofstream outfile(workDir / student["lab_dir"][i] / student["lab_sh"][i]);
+    }
+    std::filesystem::create_directories(workDir / "Require");
+
+    std::string workDirStr = workDir.string();
+    std::string name = student["name"];
+    std::string email = student["email"];
+    std::string url = student["git"];
+
+    git_init_with_config(workDirStr, name, email);
+    git_add_all(workDirStr);
+    use_git_commit(workDirStr, "init");
+    git_remote_add_origin(workDirStr, url);
+    // 首次推送记入推送日志, 由主界面的推送队列在后台完成
+    push_journal_append(workDir);
+}
+
+// welcome
+void welcome()
+{
+    TRACE_SPAN("welcome", "startup");
+    const char *WELCOME_TEXT =
+        R"(
+__        _______ _     ____ ___  __  __ _____ 
+\ \      / / ____| |   / ___/ _ \|  \/  | ____|
+ \ \ /\ / /|  _| | |  | |  | | | | |\/| |  _|  
+  \ V  V / | |___| |__| |__| |_| | |  | | |___ 
+   \_/\_/  |_____|_____\____\___/|_|  |_|_____|
+)";
+
+    int rows, cols;
+
+    getmaxyx(stdscr, rows, cols);
+    WINDOW *start_win = newwin(0, 0, 0, 0);
+    box(start_win, 0, 0);
+
+    int line_count = 0;
+    int max_width = 0;
+    size_t start = 0, end;
+    std::string text = WELCOME_TEXT;
+
+    // 计算最大宽度和行数
+    while ((end = text.find('\n', start)) != std::string::npos)
+    {
+        max_width = std::max(max_width, static_cast<int>(end - start));
+        line_count++;
+        start = end + 1;
+    }
+
+    int x = (cols - max_width) / 2;
+    int y = (rows - line_count) / 2;
+
+    // 逐行输出居中文本
+    start = 0;
+    int current_line = 0;
+    while ((end = text.find('\n', start)) != std::string::npos)
+    {
+        mvwprintw(start_win, (y + current_line), x, text.substr(start, end - start).c_str());
+        start = end + 1;
+        current_line++;
+    }
+    wrefresh(start_win);
+    // 任意键跳过, 最多停留2秒
+    wtimeout(start_win, 2000);
+    wgetch(start_win);
+    delwin(start_win);
+    clear();
+    refresh();
+}
+
+// 初始选择实验
+std::string lab_choice(nlohmann::json &student)
+{
+    TRACE_SPAN("lab_choice", "startup");
+    std::vector<std::string> dir;
+    for (int i = 0; i < student["lab_dir"].size(); i++)
+    {
+        dir.push_back(student["lab_dir"][i]);
+    }
+    WINDOW *labWin = newwin(8, 25, (LINES - 8) / 2, (COLS - 25) / 2);
+    box(labWin, 0, 0);
+    mvwprintw(labWin, 0, 1, "lab");
+    wrefresh(labWin);
+    auto *labMenu = new menuChoice(labWin, dir);
+    std::string lab_dir = dir[labMenu->run()];
+    delete labMenu;
+    delwin(labWin);
+    clear();
+    refresh();
+
+    return lab_dir;
+}
+
+// 提交历史面板
+// 按页遍历提交, 摘要放入LRU缓存, 数千个提交的仓库也能立即打开
+// 浅仓库遍历到边界时停下, 按 f 才从网络补全历史(会阻塞界面, 期间在状态行显示)
+#define HISTORY_PAGE_SIZE 64    // 每次遍历的提交数
+#define HISTORY_CACHE_SIZE 1024 // 缓存的提交摘要数
+class historyDisplay
+{
+private:
+    struct commitSummary
+    {
+        std::string line; // 已格式化的显示行
+    };
+
+    WINDOW *win;
+    std::string repoPath;
+    git_repository *repo;
+    git_revwalk *walk;
+    std::vector<git_oid> oids; // 已遍历到的提交, 按显示顺序
+    bool walkDone;
+    bool shallowEnd; // 停在浅仓库边界, 更早的提交需要补全
+    bool commitGraph;
+    std::string notice; // 状态行上的提示
+    int topLine;
+    int winHeight;
+    int winWidth;
+
+    // LRU: 链表头为最近使用, 以oid原始字节为键
+    std::list<std::pair<std::string, commitSummary>> lru;
+    std::unordered_map<std::string, std::list<std::pair<std::string, commitSummary>>::iterator> lruIndex;
+
+    void closeRepo()
+    {
+        git_revwalk_free(walk);
+        git_repository_free(repo);
+        walk = nullptr;
+        repo = nullptr;
+    }
+
+    // 打开仓库并从HEAD开始遍历, 跳过已显示的skip个提交
+    bool openWalk(size_t skip)
+    {
+        closeRepo();
+        walkDone = true;
+        if (git_repository_open(&repo, repoPath.c_str()) < 0 ||
+            git_revwalk_new(&walk, repo) < 0)
+            return false;
+        // 只按时间排序时遍历是增量的, 不会先走完整个历史
+        git_revwalk_sorting(walk, GIT_SORT_TIME);
+        if (git_revwalk_push_head(walk) < 0)
+            return false;
+        walkDone = false;
+        git_oid oid;
+        for (size_t i = 0; i < skip && git_revwalk_next(&oid, walk) == 0; ++i)
+        {
+        }
+        return true;
+    }
+
+    // 再遍历一页, 浅仓库走到边界时记下, 不自动联网
+    void loadPage()
+    {
+        if (walkDone)
+            return;
+        git_oid oid;
+        for (int i = 0; i < HISTORY_PAGE_SIZE; ++i)
+        {
+            if (git_revwalk_next(&oid, walk) != 0)
+            {
+                walkDone = true;
+                shallowEnd = git_repository_is_shallow(repo) == 1;
+                return;
+            }
+            oids.push_back(oid);
+        }
+    }
+
+    // 按 f 时补全浅仓库的历史, 从已显示的位置继续遍历
+    void fetchOlder()
+    {
+        if (!shallowEnd)
+            return;
+        notice = "fetching older history...";
+        refreshDisplay();
+        if (git_unshallow(repo) == 0)
+        {
+            shallowEnd = false;
+            notice.clear();
+            openWalk(oids.size());
+        }
+        else
+        {
+            notice = "fetch failed";
+        }
+    }
+
+    const commitSummary &summary(const git_oid &oid)
+    {
+        std::string key(reinterpret_cast<const char *>(oid.id), sizeof(oid.id));
+        auto found = lruIndex.find(key);
+        if (found != lruIndex.end())
+        {
+            lru.splice(lru.begin(), lru, found->second);
+            return found->second->second;
+        }
+
+        commitSummary entry;
+        git_commit *commit = nullptr;
+        char shortId[8];
+        git_oid_tostr(shortId, sizeof(shortId), &oid);
+        if (git_commit_lookup(&commit, repo, &oid) == 0)
+        {
+            char date[20];
+            std::time_t when = git_commit_time(commit);
+            std::strftime(date, sizeof(date), "%Y-%m-%d %H:%M", std::localtime(&when));
+            const char *text = git_commit_summary(commit);
+            entry.line = std::string(shortId) + " " + date + " " +
+                         git_commit_author(commit)->name + ": " + (text ? text : "");
+            git_commit_free(commit);
+        }
+        else
+        {
+            entry.line = std::string(shortId) + " <missing>";
+        }
+
+        lru.emplace_front(key, entry);
+        lruIndex[key] = lru.begin();
+        if (lru.size() > HISTORY_CACHE_SIZE)
+        {
+            lruIndex.erase(lru.back().first);
+            lru.pop_back();
+        }
+        return lru.front().second;
+    }
+
+    // 保证可见范围及下一页已遍历
+    void ensureLoaded()
+    {
+        while (!walkDone && (int)oids.size() < topLine + 2 * winHeight)
+            loadPage();
+    }
+
+public:
+    historyDisplay(WINDOW *window, const std::string &repo_path)
+        : repoPath(repo_path), repo(nullptr), walk(nullptr), walkDone(true),
+          shallowEnd(false), commitGraph(false), topLine(0)
+    {
+        int h, w;
+        getmaxyx(window, h, w);
+        win = derwin(window, h - 2, w - 2, 1, 1);
+        getmaxyx(win, winHeight, winWidth);
+    }
+
+    ~historyDisplay()
+    {
+        closeRepo();
+        delwin(win);
+    }
+
+    // 每次打开面板时从当前HEAD重新遍历, 摘要缓存保留
+    void open()
+    {
+        oids.clear();
+        topLine = 0;
+        shallowEnd = false;
+        notice.clear();
+        commitGraph = std::filesystem::exists(std::filesystem::path(repoPath) / ".git" / "objects" / "info" / "commit-graph");
+        openWalk(0);
+        ensureLoaded();
+        refreshDisplay();
+    }
+
+    void refreshDisplay()
+    {
+        werase(win);
+        int linesToShow = std::min(winHeight - 1, (int)oids.size() - topLine);
+        for (int i = 0; i < linesToShow; ++i)
+        {
+            const std::string &line = summary(oids[topLine + i]).line;
+            mvwaddnstr(win, i, 0, line.c_str(), winWidth);
+        }
+
+        std::string status = std::to_string(oids.empty() ? 0 : topLine + 1) + "/" +
+                             std::to_string(oids.size()) + (walkDone ? "" : "+") +
+                             (commitGraph ? " [commit-graph]" : "") +
+                             (shallowEnd ? " [shallow, f: fetch older]" : "") +
+                             (notice.empty() ? "" : " " + notice);
+        mvwaddstr(win, winHeight - 1, std::max(0, winWidth - (int)status.length() - 1), status.c_str());
+        wrefresh(win);
+    }
+
+    void handleInput(int ch)
+    {
+        int maxTop = std::max(0, (int)oids.size() - (winHeight - 1));
+        switch (ch)
+        {
+        case KEY_UP:
+            topLine = std::max(0, topLine - 1);
+            break;
+        case KEY_DOWN:
+            topLine = std::min(maxTop, topLine + 1);
+            break;
+        case KEY_PPAGE:
+            topLine = std::max(0, topLine - winHeight);
+            break;
+        case KEY_NPAGE:
+            topLine = std::min(maxTop, topLine + winHeight);
+            break;
+        case 'f':
+            fetchOlder();
+            break;
+        default:
+            break;
+        }
+        ensureLoaded();
+        // 新加载的页可能让向下翻页继续有效
+        if (ch == KEY_DOWN || ch == KEY_NPAGE)
+            topLine = std::min(std::max(0, (int)oids.size() - (winHeight - 1)), topLine);
+        refreshDisplay();
+    }
+
+    void close()
+    {
+        closeRepo();
+    }
+};
+
+// 录像回放
+// 分段按清单中的时长二分定位, 打开分段时顺序重放一遍, 每隔 CAST_KEYFRAME_SECONDS 保存一帧终端快照,
+// 之后跳转只需二分找到最近的关键帧, 再重放不超过 CAST_KEYFRAME_SECONDS 的事件
+#define CAST_KEYFRAME_SECONDS 10
+class castPlayer
+{
+private:
+    struct segment
+    {
+        std::filesystem::path path;
+        bool compressed;
+        double start; // 在整个录像中的开始时间
+        double duration;
+    };
+
+    struct keyframe
+    {
+        double time;   // 分段内时间
+        size_t offset; // 下一个事件在分段文本中的位置
+        vtScreen screen;
+    };
+
+    std::vector<segment> segments;
+    double total;
+    int current; // 已打开的分段
+    std::string text;   // 解压后的分段
+    void *mapped;       // 旧录像直接映射, 不读入内存
+    size_t mappedSize;
+    const char *data;
+    size_t size;
+    std::vector<keyframe> keyframes;
+    vtScreen screen;
+    size_t offset;   // 下一个事件位置
+    double position; // 分段内的当前时间
+    bool redraw;
+
+    void unload()
+    {
+        if (mapped)
+            munmap(mapped, mappedSize);
+        mapped = nullptr;
+        text.clear();
+        text.shrink_to_fit();
+        data = nullptr;
+        size = 0;
+        keyframes.clear();
+        current = -1;
+    }
+
+    bool load(int index)
+    {
+        unload();
+        const segment &seg = segments[index];
+        if (seg.compressed)
+        {
+            if (!decompress_cast_segment(seg.path, text))
+                return false;
+            data = text.data();
+            size = text.size();
+        }
+        else
+        {
+            int fd = ::open(seg.path.c_str(), O_RDONLY);
+            struct stat st;
+            if (fd < 0 || fstat(fd, &st) < 0 || st.st_size == 0)
+            {
+                if (fd >= 0)
+                    ::close(fd);
+                return false;
+            }
+            mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if (mapped == MAP_FAILED)
+            {
+                mapped = nullptr;
+                return false;
+            }
+            mappedSize = st.st_size;
+            data = static_cast<const char *>(mapped);
+            size = mappedSize;
+        }
+
+        // 第一行是头部, 给出终端大小
+        const char *end = static_cast<const char *>(memchr(data, '\n', size));
+        size_t headerEnd = end ? end - data + 1 : size;
+        nlohmann::json header = nlohmann::json::parse(data, data + headerEnd, nullptr, false);
+        int width = 80, height = 24;
+        if (!header.is_discarded() && header.is_object())
+        {
+            if (header.contains("width") && header["width"].is_number_integer())
+                width = header["width"].get<int>();
+            if (header.contains("height") && header["height"].is_number_integer())
+                height = header["height"].get<int>();
+        }
+        screen = vtScreen(height, width);
+        offset = headerEnd;
+        position = 0;
+        keyframes.push_back(keyframe{0, offset, screen});
+
+        // 建立整个分段的关键帧索引, 然后回到开头
+        advance(HUGE_VAL);
+        screen = keyframes.front().screen;
+        offset = keyframes.front().offset;
+        position = 0;
+        current = index;
+        redraw = true;
+        return true;
+    }
+
+    // 下一个事件的时间, 只解析行首的数字
+    bool peekTime(double &time) const
+    {
+        if (offset >= size || data[offset] != '[')
+            return false;
+        char number[32];
+        size_t len = std::min(sizeof(number) - 1, size - offset - 1);
+        memcpy(number, data + offset + 1, len);
+        number[len] = '\0';
+        time = std::strtod(number, nullptr);
+        return true;
+    }
+
+    // 重放到分段内时间local
+    void advance(double local)
+    {
+        double time = position;
+        while (offset < size)
+        {
+            bool timed = peekTime(time);
+            if (timed && time > local)
+                break;
+            const char *end = static_cast<const char *>(memchr(data + offset, '\n', size - offset));
+            size_t lineEnd = end ? end - data : size;
+            nlohmann::json event = nlohmann::json::parse(data + offset, data + lineEnd, nullptr, false);
+            offset = std::min(size, lineEnd + 1);
+            if (event.is_discarded() || !event.is_array() || event.size() < 3 || !event[1].is_string() ||
+                !event[2].is_string())
+                continue;
+
+            const std::string &type = event[1].get_ref<const std::string &>();
+            const std::string &payload = event[2].get_ref<const std::string &>();
+            if (type == "o")
+            {
+                screen.feed(payload.data(), payload.size());
+            }
+            else if (type == "r")
+            {
+                // 格式为 宽x高, strtol 对过大的值饱和, vtScreen 再限制到 VT_MAX_SIZE
+                char *rest = nullptr;
+                long width = std::strtol(payload.c_str(), &rest, 10);
+                long height = *rest == 'x' ? std::strtol(rest + 1, nullptr, 10) : 0;
+                if (width > 0 && height > 0)
+                {
+                    screen.resize(std::min<long>(height, VT_MAX_SIZE), std::min<long>(width, VT_MAX_SIZE));
+                    redraw = true;
+                }
+            }
+
+            // 建立索引时每隔 CAST_KEYFRAME_SECONDS 保存一帧
+            if (timed && time >= keyframes.back().time + CAST_KEYFRAME_SECONDS && offset > keyframes.back().offset)
+                keyframes.push_back(keyframe{time, offset, screen});
+        }
+        position = local;
+    }
+
+public:
+    castPlayer()
+        : total(0), current(-1), mapped(nullptr), mappedSize(0), data(nullptr), size(0),
+          screen(24, 80), offset(0), position(0), redraw(true)
+    {
+    }
+
+    ~castPlayer()
+    {
+        unload();
+    }
+
+    castPlayer(const castPlayer &) = delete;
+    castPlayer &operator=(const castPlayer &) = delete;
+
+    // 旧的 labN.cast 在前, 之后是 labN.cast.d/ 中的分段
+    bool open(const std::filesystem::path &recording_file)
+    {
+        unload();
+        segments.clear();
+        total = 0;
+        std::error_code ec;
+        if (std::filesystem::exists(recording_file, ec) && std::filesystem::file_size(recording_file, ec) > 0)
+        {
+            segments.push_back(segment{recording_file, false, 0, cast_file_duration(recording_file)});
+        }
+        std::filesystem::path segment_dir = cast_segment_dir(recording_file);
+        nlohmann::json manifest = load_cast_manifest(segment_dir);
+        for (const auto &info : manifest["segments"])
+        {
+            if (!info.contains("file") || !info["file"].is_string())
+                continue;
+            double duration = info.contains("duration") && info["duration"].is_number() ? info["duration"].get<double>() : 0;
+            segments.push_back(segment{segment_dir / info["file"].get<std::string>(), true, 0, duration});
+        }
+        for (auto &seg : segments)
+        {
+            seg.start = total;
+            total += seg.duration;
+        }
+        return !segments.empty() && seek(0);
+    }
+
+    void close()
+    {
+        unload();
+        segments.clear();
+        total = 0;
+    }
+
+    double duration() const
+    {
+        return total;
+    }
+
+    double time() const
+    {
+        return current < 0 ? 0 : segments[current].start + position;
+    }
+
+    int segmentIndex() const
+    {
+        return current;
+    }
+
+    int segmentCount() const
+    {
+        return segments.size();
+    }
+
+    const vtScreen &view() const
+    {
+        return screen;
+    }
+
+    vtScreen &view()
+    {
+        return screen;
+    }
+
+    // 画面被整体替换(跳转/改变大小)后需要清空窗口
+    bool takeRedraw()
+    {
+        bool value = redraw;
+        redraw = false;
+        return value;
+    }
+
+    bool seek(double t)
+    {
+        if (segments.empty())
+            return false;
+        t = std::max(0.0, std::min(total, t));
+        // 二分找到t所在的分段
+        auto seg = std::upper_bound(segments.begin(), segments.end(), t,
+                                    [](double value, const segment &s)
+                                    { return value < s.start; });
+        int index = std::max(0, (int)(seg - segments.begin()) - 1);
+        if (index != current && !load(index))
+            return false;
+
+        // 二分找到不晚于目标时间的关键帧
+        double local = t - segments[index].start;
+        auto frame = std::upper_bound(keyframes.begin(), keyframes.end(), local,
+                                      [](double value, const keyframe &k)
+                                      { return value < k.time; });
+        --frame;
+        if (local < position || frame->time > position)
+        {
+            screen = frame->screen;
+            offset = frame->offset;
+            position = frame->time;
+            screen.touch();
+            redraw = true;
+        }
+        advance(local);
+        return true;
+    }
+};
+
+#define PLAYBACK_TICK_MS 50
+#define PLAYBACK_MAX_SPEED 64
+class playbackDisplay
+{
+private:
+    WINDOW *frame; // 接收按键的外框窗口
+    WINDOW *win;
+    WINDOW *view; // 终端画面
+    castPlayer player;
+    bool ready;
+    bool paused;
+    double speed;
+    std::chrono::steady_clock::time_point lastTick;
+    int winHeight;
+    int winWidth;
+
+    static std::string clock(double seconds)
+    {
+        char text[32];
+        long total = (long)seconds;
+        snprintf(text, sizeof(text), "%ld:%02ld:%02ld", total / 3600, total / 60 % 60, total % 60);
+        return text;
+    }
+
+    // 读入跳转时间, 支持 h:mm:ss / mm:ss / 秒
+    bool promptTime(double &seconds)
+    {
+        char input[16] = {0};
+        mvwhline(win, winHeight - 1, 0, ' ', winWidth);
+        mvwaddstr(win, winHeight - 1, 0, "jump to: ");
+        wtimeout(frame, -1);
+        echo();
+        curs_set(1);
+        wgetnstr(win, input, sizeof(input) - 1);
+        noecho();
+        curs_set(0);
+        wtimeout(frame, PLAYBACK_TICK_MS);
+        lastTick = std::chrono::steady_clock::now();
+
+        double parts[3] = {0, 0, 0};
+        int count = sscanf(input, "%lf:%lf:%lf", &parts[0], &parts[1], &parts[2]);
+        if (count <= 0)
+            return false;
+        seconds = 0;
+        for (int i = 0; i < count; ++i)
+            seconds = seconds * 60 + parts[i];
+        return true;
+    }
+
+public:
+    playbackDisplay(WINDOW *window)
+        : frame(window), ready(false), paused(false), speed(1)
+    {
+        int h, w;
+        getmaxyx(window, h, w);
+        win = derwin(window, h - 2, w - 2, 1, 1);
+        getmaxyx(win, winHeight, winWidth);
+        view = derwin(win, winHeight - 1, winWidth, 0, 0);
+    }
+
+    ~playbackDisplay()
+    {
+        delwin(view);
+        delwin(win);
+    }
+
+    void open(const std::filesystem::path &recording_file)
+    {
+        werase(win);
+        ready = player.open(recording_file);
+        paused = false;
+        speed = 1;
+        lastTick = std::chrono::steady_clock::now();
+        wtimeout(frame, PLAYBACK_TICK_MS);
+        if (!ready)
+            mvwaddstr(win, 0, 0, "No recording for this lab.");
+        refreshDisplay();
+    }
+
+    void refreshDisplay()
+    {
+        if (ready)
+        {
+            if (player.takeRedraw())
+                werase(view);
+            player.view().render(view);
+        }
+
+        char status[128];
+        snprintf(status, sizeof(status), "%s / %s  x%g%s  seg %d/%d  space:pause <>:10s []:speed j:jump q:quit",
+                 clock(player.time()).c_str(), clock(player.duration()).c_str(), speed,
+                 paused ? " [paused]" : "", player.segmentIndex() + 1, player.segmentCount());
+        mvwhline(win, winHeight - 1, 0, ' ', winWidth);
+        mvwaddnstr(win, winHeight - 1, 0, status, winWidth);
+        wrefresh(win);
+    }
+
+    // 按经过的时间推进播放
+    void tick()
+    {
+        auto now = std::chrono::steady_clock::now();
+        double elapsed = std::chrono::duration<double>(now - lastTick).count();
+        lastTick = now;
+        if (!ready || paused)
+            return;
+        player.seek(player.time() + elapsed * speed);
+        if (player.time() >= player.duration())
+            paused = true;
+        refreshDisplay();
+    }
+
+    void handleInput(int ch)
+    {
+        if (!ready)
+            return;
+        double target = player.time();
+        switch (ch)
+        {
+        case ' ':
+            paused = !paused;
+            if (!paused && player.time() >= player.duration())
+                target = 0;
+            break;
+        case KEY_RIGHT:
+        case '>':
+            target += 10;
+            break;
+        case KEY_LEFT:
+        case '<':
+            target -= 10;
+            break;
+        case KEY_NPAGE:
+            target += 60;
+            break;
+        case KEY_PPAGE:
+            target -= 60;
+            break;
+        case KEY_HOME:
+            target = 0;
+            break;
+        case KEY_END:
+            target = player.duration();
+            break;
+        case ']':
+        case '+':
+            speed = std::min<double>(PLAYBACK_MAX_SPEED, speed * 2);
+            break;
+        case '[':
+        case '-':
+            speed = std::max(0.25, speed / 2);
+            break;
+        case 'j':
+            promptTime(target);
+            break;
+        default:
+            if (ch >= '0' && ch <= '9')
+                target = player.duration() * (ch - '0') / 10;
+            break;
+        }
+        if (target != player.time())
+            player.seek(target);
+        refreshDisplay();
+    }
+
+    void close()
+    {
+        wtimeout(frame, -1);
+        player.close();
+    }
+};
+
+// 运行面板
+// 脚本在伪终端中运行, 输出写入固定大小的环形缓冲区, 只绘制可见的行,
+// 无论脚本输出多少, 内存占用都不变
+#define RUN_RING_BYTES (1 << 20) // 保留的输出字节数
+#define RUN_RING_LINES 65536     // 保留的行数
+#define RUN_TIMEOUT_S 10
+#define RUN_FRAME_MS 50 // 输出很多时最多每50ms重绘一次
+class outputRing
+{
+private:
+    std::vector<char> data;
+    uint64_t begin; // 缓冲区中最早字节的绝对位置
+    uint64_t end;   // 下一个字节的绝对位置
+    std::deque<uint64_t> lines; // 每行开始的绝对位置
+    uint64_t droppedLines;
+    uint64_t totalBytes;
+    bool inEscape; // 跳过颜色等控制序列
+
+public:
+    outputRing(size_t capacity = RUN_RING_BYTES)
+        : data(capacity)
+    {
+        clear();
+    }
+
+    void clear()
+    {
+        begin = end = 0;
+        lines.assign(1, 0);
+        droppedLines = 0;
+        totalBytes = 0;
+        inEscape = false;
+    }
+
+    void append(const char *text, size_t len)
+    {
+        totalBytes += len;
+        for (size_t i = 0; i < len; ++i)
+        {
+            char c = text[i];
+            if (inEscape)
+            {
+                // ESC [ ... 以字母结束
+                if ((c >= '@' && c <= '~' && c != '[') || c == '\n')
+                    inEscape = false;
+                continue;
+            }
+            if (c == '\033')
+            {
+                inEscape = true;
+                continue;
+            }
+            if (c == '\r')
+                continue;
+            data[end % data.size()] = c;
+            end++;
+            if (c == '\n')
+                lines.push_back(end);
+        }
+
+        // 覆盖最旧的数据, 丢弃已被覆盖的行
+        if (end - begin > data.size())
+            begin = end - data.size();
+        while (lines.size() > RUN_RING_LINES || (lines.size() > 1 && lines[1] <= begin))
+        {
+            lines.pop_front();
+            droppedLines++;
+        }
+        begin = std::max(begin, lines.front());
+    }
+
+    size_t lineCount() const
+    {
+        return lines.size();
+    }
 
-    int rows, cols;
+    // 第一行之前被丢弃的行数, 用于显示真实行号
+    uint64_t firstLineNumber() const
+    {
+        return droppedLines + 1;
+    }
 
-    getmaxyx(stdscr, rows, cols);
-    WINDOW *start_win = newwin(0, 0, 0, 0);
-    box(start_win, 0, 0);
+    uint64_t bytes() const
+    {
+        return totalBytes;
+    }
 
-    int line_count = 0;
-    int max_width = 0;
-    size_t start = 0, end;
-    std::string text = WELCOME_TEXT;
+    std::string line(size_t index, size_t maxLength) const
+    {
+        uint64_t from = std::max(lines[index], begin);
+        uint64_t to = index + 1 < lines.size() ? lines[index + 1] - 1 : end;
+        std::string text;
+        for (uint64_t pos = from; pos < to && text.size() < maxLength; ++pos)
+        {
+            char c = data[pos % data.size()];
+            text += (c == '\t' || (unsigned char)c >= 0x20) ? c : '?';
+        }
+        return text;
+    }
+};
 
-    // 计算最大宽度和行数
-    while ((end = text.find('\n', start)) != std::string::npos)
+class runDisplay
+{
+private:
+    WINDOW *frame;
+    WINDOW *win;
+    outputRing output;
+    size_t topLine;
+    bool follow; // 跟随最新输出
+    std::string status;
+    int winHeight;
+    int winWidth;
+
+    void refreshDisplay()
     {
-        max_width = std::max(max_width, static_cast<int>(end - start));
-        line_count++;
-        start = end + 1;
+        int rows = winHeight - 1;
+        size_t count = output.lineCount();
+        if (follow)
+            topLine = count > (size_t)rows ? count - rows : 0;
+        topLine = std::min(topLine, count - 1);
+        werase(win);
+        for (int i = 0; i < rows && topLine + i < count; ++i)
+        {
+            std::string text = output.line(topLine + i, winWidth);
+            mvwaddnstr(win, i, 0, text.c_str(), winWidth);
+        }
+        char info[96];
+        snprintf(info, sizeof(info), "  line %llu/%llu  %.1f MB%s",
+                 (unsigned long long)(output.firstLineNumber() + topLine),
+                 (unsigned long long)(output.firstLineNumber() + count - 1),
+                 output.bytes() / 1048576.0, follow ? "" : "  [scroll]");
+        std::string line = status + info;
+        wattron(win, A_REVERSE);
+        mvwhline(win, winHeight - 1, 0, ' ', winWidth);
+        mvwaddnstr(win, winHeight - 1, 0, line.c_str(), winWidth);
+        wattroff(win, A_REVERSE);
+        wrefresh(win);
     }
 
-    int x = (cols - max_width) / 2;
-    int y = (rows - line_count) / 2;
+    // 方向键等用于滚动, 返回是否已处理
+    bool scrollView(int ch)
+    {
+        int rows = winHeight - 1;
+        size_t count = output.lineCount();
+        size_t maxTop = count > (size_t)rows ? count - rows : 0;
+        switch (ch)
+        {
+        case KEY_UP:
+            topLine = topLine > 0 ? topLine - 1 : 0;
+            break;
+        case KEY_DOWN:
+            topLine = std::min(maxTop, topLine + 1);
+            break;
+        case KEY_PPAGE:
+            topLine = topLine > (size_t)rows ? topLine - rows : 0;
+            break;
+        case KEY_NPAGE:
+            topLine = std::min(maxTop, topLine + rows);
+            break;
+        case KEY_HOME:
+            topLine = 0;
+            break;
+        case KEY_END:
+            follow = true;
+            return true;
+        default:
+            return false;
+        }
+        follow = topLine == maxTop;
+        return true;
+    }
 
-    // 逐行输出居中文本
-    start = 0;
-    int current_line = 0;
-    while ((end = text.find('\n', start)) != std::string::npos)
+public:
+    runDisplay(WINDOW *window)
+        : frame(window), topLine(0), follow(true)
     {
-        mvwprintw(start_win, (y + current_line), x, text.substr(start, end - start).c_str());
-        start = end + 1;
-        current_line++;
+        int h, w;
+        getmaxyx(window, h, w);
+        win = derwin(window, h - 2, w - 2, 1, 1);
+        getmaxyx(win, winHeight, winWidth);
     }
-    wrefresh(start_win);
-    napms(2000);
-    delwin(start_win);
-    clear();
-    refresh();
-}
 
-// 初始选择实验
-std::string lab_choice(nlohmann::json &student)
-{
-    std::vector<std::string> dir;
-    for (int i = 0; i < student["lab_dir"].size(); i++)
+    ~runDisplay()
     {
-        dir.push_back(student["lab_dir"][i]);
+        delwin(win);
     }
-    WINDOW *labWin = newwin(8, 25, (LINES - 8) / 2, (COLS - 25) / 2);
-    box(labWin, 0, 0);
-    mvwprintw(labWin, 0, 1, "lab");
-    wrefresh(labWin);
-    auto *labMenu = new menuChoice(labWin, dir);
-    std::string lab_dir = dir[labMenu->run()];
-    delete labMenu;
-    delwin(labWin);
-    clear();
-    refresh();
 
-    return lab_dir;
-}
+    // 运行脚本直到结束并关闭面板('q')
+    void run(const std::filesystem::path &script, const sandboxLimits &limits)
+    {
+        output.clear();
+        topLine = 0;
+        follow = true;
+        status = "running " + script.filename().string() + " (Ctrl-C stops it)";
+
+        struct winsize size = {};
+        size.ws_row = winHeight - 1;
+        size.ws_col = winWidth;
+        int master = -1;
+        std::string scriptPath = std::filesystem::absolute(script).string();
+        std::string dir = script.parent_path().string();
+        pid_t pid = forkpty(&master, nullptr, nullptr, &size);
+        if (pid == 0)
+        {
+            if (chdir(dir.c_str()) < 0)
+                _exit(127);
+            apply_sandbox_limits(limits);
+            execl("/bin/bash", "bash", scriptPath.c_str(), nullptr);
+            _exit(127);
+        }
+        if (pid < 0)
+            status = "failed to start " + script.filename().string();
+        else
+            fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+
+        // Ctrl-C 以 0x03 读入后转发给脚本的终端, 而不是向本程序发 SIGINT
+        raw();
+        keypad(frame, TRUE);
+        nodelay(frame, TRUE);
+        auto begin = std::chrono::steady_clock::now();
+        auto deadline = begin + std::chrono::milliseconds(limits.timeoutMs);
+        auto lastFrame = begin;
+        bool timedOut = false;
+        bool reaped = false;
+        int exitStatus = 0;
+        char buf[65536];
+        // 一次最多读一帧时间的输出, 保证按键仍能及时处理, 返回true表示读到结尾
+        auto readOutput = [&]()
+        {
+            auto readStart = std::chrono::steady_clock::now();
+            while (std::chrono::steady_clock::now() - readStart < std::chrono::milliseconds(RUN_FRAME_MS))
+            {
+                ssize_t n = read(master, buf, sizeof(buf));
+                if (n > 0)
+                    output.append(buf, n);
+                else
+                    return n == 0 || errno != EAGAIN; // EIO: 脚本已退出
+            }
+            return false;
+        };
+        refreshDisplay();
+        while (pid > 0)
+        {
+            struct pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0}, {master, POLLIN, 0}};
+            poll(fds, 2, RUN_FRAME_MS);
+
+            bool exited = readOutput();
+            auto now = std::chrono::steady_clock::now();
+
+            // 每轮都取完按键: ncurses 可能已把按键读进自己的缓冲区, 此时 poll 不会再报告 STDIN 可读
+            int ch;
+            while ((ch = wgetch(frame)) != ERR)
+            {
+                // 滚动键之外的按键交给脚本(可以回答 read)
+                if (!scrollView(ch))
+                {
+                    std::string keys = vt_key_sequence(ch, false);
+                    write(master, keys.data(), keys.size());
+                }
+            }
+
+            // 脚本退出但后台进程仍占用终端时不会读到EIO
+            if (!exited && waitpid(pid, &exitStatus, WNOHANG) == pid)
+            {
+                reaped = true;
+                exited = true;
+            }
+            if (now >= deadline)
+            {
+                timedOut = true;
+                kill(-pid, SIGKILL);
+            }
+            if (exited || timedOut)
+                break;
+            if (now - lastFrame >= std::chrono::milliseconds(RUN_FRAME_MS))
+            {
+                refreshDisplay();
+                lastFrame = now;
+            }
+        }
+
+        if (pid > 0)
+        {
+            // 脚本最后的输出可能在上次读取之后才写入, 结束进程组之前读完
+            if (!timedOut)
+                readOutput();
+            kill(-pid, SIGKILL);
+            if (!reaped)
+                waitpid(pid, &exitStatus, 0);
+            close(master);
+            char text[96];
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+            if (timedOut)
+                snprintf(text, sizeof(text), "killed after %ds timeout", limits.timeoutMs / 1000);
+            else if (WIFSIGNALED(exitStatus))
+                snprintf(text, sizeof(text), "killed by signal %d after %.1fs", WTERMSIG(exitStatus), seconds);
+            else
+                snprintf(text, sizeof(text), "exit %d in %.1fs", WEXITSTATUS(exitStatus), seconds);
+            status = text;
+        }
+        nodelay(frame, FALSE);
+        noraw();
+        cbreak();
+        status += " (q: close)";
+        refreshDisplay();
 
-void mainProgram(const nlohmann::json &student, const std::filesystem::path &workDir, const std::string &lab_c)
+        int ch;
+        while ((ch = wgetch(frame)) != 'q')
+        {
+            scrollView(ch);
+            refreshDisplay();
+        }
+    }
+};
+
+// 返回false表示推送线程仍卡在libgit2中, 调用者不能再使用libgit2
+bool mainProgram(const nlohmann::json &student, const std::filesystem::path &workDir, const std::string &lab_c,
+                 asyncPull *pull = nullptr)
 {
 
     std::string lab = lab_c;               // 实验
     std::string shellFile = lab + ".sh";   // 学生的shell脚本
     std::string demandFile = lab + ".txt"; // 要求
     std::string recordFile = lab + ".cast";
-    std::string gitUrl = student["git"];
     std::string editor = student["editor"];
     std::vector<std::string> dir;
     for (int i = 0; i < student["lab_dir"].size(); i++)
@@ -1947,6 +7230,8 @@ void mainProgram(const nlohmann::json &student, const std::filesystem::path &wor
     box(shellWin, 0, 0);
     mvwprintw(shellWin, 0, 1, "Shell");
     //wrefresh(shellWin);
+    // 编辑器在Shell面板内部运行
+    WINDOW *editWin = derwin(shellWin, height - 6, width / 2 - 3, 1, 1);
     // 要求窗口
     WINDOW *demandWin = derwin(mainWin, height - 4, width / 2 - 1, 1, (width / 2 + 1));
     box(demandWin, 0, 0);
@@ -1957,10 +7242,38 @@ void mainProgram(const nlohmann::json &student, const std::filesystem::path &wor
     box(buttonWIN, 0, 0);
     mvwprintw(buttonWIN, 0, 1, "Button");
     mvwprintw(buttonWIN, 1, 1, "s:start");
-    mvwprintw(buttonWIN, 1, 11, "g:git");
-    mvwprintw(buttonWIN, 1, 21, "c:check");
-    mvwprintw(buttonWIN, 1, 31, "l:choice lab");
-    mvwprintw(buttonWIN, 1, 51, "q:exit");
+    mvwprintw(buttonWIN, 1, 10, "g:git");
+    mvwprintw(buttonWIN, 1, 17, "c:check");
+    mvwprintw(buttonWIN, 1, 26, "r:run");
+    mvwprintw(buttonWIN, 1, 33, "l:choice lab");
+    mvwprintw(buttonWIN, 1, 47, "h:history");
+    mvwprintw(buttonWIN, 1, 58, "p:play");
+    mvwprintw(buttonWIN, 1, 66, "q:exit");
+    mvwprintw(buttonWIN, 1, 74, "n:next issue");
+    // 拉取/推送/领先落后状态画在按钮栏上边框的右侧, 按窗口宽度排布, 放不下时截断
+    std::string pullStatus = pull ? "pull: syncing" : "";
+    std::string pushStatus, aheadStatus;
+    auto showStatus = [&]()
+    {
+        int barWidth = getmaxx(buttonWIN);
+        int room = barWidth - 9; // 左侧保留 "Button" 标题
+        std::string text;
+        for (const std::string *part : {&pullStatus, &pushStatus, &aheadStatus})
+        {
+            if (!part->empty())
+                text += (text.empty() ? " " : " | ") + *part;
+        }
+        if (!text.empty())
+            text += " ";
+        mvwhline(buttonWIN, 0, 7, ACS_HLINE, barWidth - 8);
+        if (room > 0 && !text.empty())
+        {
+            text = text.substr(0, room);
+            mvwprintw(buttonWIN, 0, barWidth - 1 - (int)text.size(), "%s", text.c_str());
+        }
+        wrefresh(buttonWIN);
+    };
+    showStatus();
     //wrefresh(buttonWIN);
     // git窗口
     WINDOW *gitWin = newwin(20, 60, (LINES - 20) / 2, (COLS - 60) / 2);
@@ -1969,15 +7282,31 @@ void mainProgram(const nlohmann::json &student, const std::filesystem::path &wor
     // shellcheck窗口
     WINDOW *checkWin = newwin(LINES - 4, 60, 1, (COLS - 60) / 2);
     box(checkWin, 0, 0);
-    mvwprintw(checkWin, 0, 1, "ShellCheck Results");
+    mvwprintw(checkWin, 0, 1, "ShellCheck Results (n: next issue in Shell)");
     // 实验选择窗口
     WINDOW *labWin = newwin(8, 25, (LINES - 8) / 2, (COLS - 25) / 2);
     box(labWin, 0, 0);
     mvwprintw(labWin, 0, 1, "lab");
+    // 提交历史窗口
+    WINDOW *historyWin = newwin(LINES - 4, std::min(COLS - 2, 100), 1, (COLS - std::min(COLS - 2, 100)) / 2);
+    box(historyWin, 0, 0);
+    mvwprintw(historyWin, 0, 1, "History");
+    keypad(historyWin, TRUE);
+    // 录像回放窗口
+    WINDOW *playbackWin = newwin(LINES - 2, COLS - 2, 1, 1);
+    box(playbackWin, 0, 0);
+    mvwprintw(playbackWin, 0, 1, "Playback");
+    keypad(playbackWin, TRUE);
     // 退出选项窗口
     WINDOW *exitWin = newwin(8, 25, (LINES - 8) / 2, (COLS - 25) / 2); // 退出窗口
     box(exitWin, 0, 0);
     mvwprintw(exitWin, 0, 1, "Exit");
+    // 运行窗口
+    WINDOW *runWin = newwin(LINES - 4, COLS - 2, 1, 1);
+    box(runWin, 0, 0);
+    mvwprintw(runWin, 0, 1, "Run");
+    // 性能浮层(F12 切换)
+    WINDOW *hudWin = newwin(6, 44, 1, std::max(0, COLS - 45));
     refresh();
 
     // 创建面板
@@ -1986,6 +7315,11 @@ void mainProgram(const nlohmann::json &student, const std::filesystem::path &wor
     PANEL *checkPanel = new_panel(checkWin);
     PANEL *labPanel = new_panel(labWin);
     PANEL *exitPanel = new_panel(exitWin);
+    PANEL *historyPanel = new_panel(historyWin);
+    PANEL *playbackPanel = new_panel(playbackWin);
+    PANEL *runPanel = new_panel(runWin);
+    PANEL *hudPanel = new_panel(hudWin);
+    hide_panel(hudPanel);
     top_panel(mainPanel);
     update_panels();
     doupdate();
@@ -1993,13 +7327,95 @@ void mainProgram(const nlohmann::json &student, const std::filesystem::path &wor
     FileDisplay *shellDisplay = new FileDisplay(shellWin, workDir / lab / shellFile);
     FileDisplay *demandDisplay = new FileDisplay(demandWin, workDir / "Require" / demandFile);
     // shellcheck对象
-    FileDisplay *checkDisplay = new FileDisplay(checkWin, CHECK_PATH);
+    FileDisplay *checkDisplay = new FileDisplay(checkWin, "");
+    checkDisplay->setPlainText(true);
+    // ShellCheck 诊断表
+    diagnosticTable *diagnostics = new diagnosticTable();
     // git对象
     gitInterface *git = new gitInterface(gitWin, workDir/lab);
     // 实验选择对象
     menuChoice *labChoice = new menuChoice(labWin, dir);
     // 退出选择对象
     menuChoice *labExit = new menuChoice(exitWin, exitInfo);
+    // 后台预检查对象
+    lintWorker *lint = new lintWorker();
+    // 提交历史对象
+    historyDisplay *history = new historyDisplay(historyWin, workDir);
+    // 录像回放对象
+    playbackDisplay *playback = new playbackDisplay(playbackWin);
+    // 运行面板对象, student.json 中可用 run_timeout_s / run_memory_mb 调整限制
+    runDisplay *runner = new runDisplay(runWin);
+    sandboxLimits runLimits;
+    runLimits.timeoutMs = student.value("run_timeout_s", RUN_TIMEOUT_S) * 1000;
+    runLimits.memoryMb = student.value("run_memory_mb", SANDBOX_MEMORY_MB);
+    // 按键延迟统计
+    perfMonitor *perf = new perfMonitor();
+    bool hudVisible = false;
+    auto showHud = [&]()
+    {
+        const hdrHistogram &latency = perf->latencyUs();
+        const hdrHistogram &bytes = perf->bytesPerFrame();
+        werase(hudWin);
+        box(hudWin, 0, 0);
+        mvwprintw(hudWin, 0, 1, "Perf");
+        mvwprintw(hudWin, 1, 1, "frames %llu  terminal %llu KiB", (unsigned long long)latency.count(),
+                  (unsigned long long)(perf->terminalBytes() / 1024));
+        mvwprintw(hudWin, 2, 1, "key->paint p50 %.1fms p99 %.1fms", latency.percentile(50) / 1000.0,
+                  latency.percentile(99) / 1000.0);
+        mvwprintw(hudWin, 3, 1, "           max %.1fms", latency.max() / 1000.0);
+        mvwprintw(hudWin, 4, 1, "bytes/frame p50 %llu p99 %llu", (unsigned long long)bytes.percentile(50),
+                  (unsigned long long)bytes.percentile(99));
+        top_panel(hudPanel);
+        update_panels();
+        doupdate();
+    };
+    // 推送队列
+    pushQueue *pushes = new pushQueue(workDir, student_remotes(student));
+    if (!pull)
+        pushes->start();
+    // 在按钮栏显示与远程相比领先/落后的提交数
+    auto showAheadBehind = [&]()
+    {
+        size_t ahead = 0, behind = 0;
+        if (git_ahead_behind(workDir.string(), ahead, behind))
+        {
+            aheadStatus = "ahead:" + std::to_string(ahead) + " behind:" + std::to_string(behind);
+            showStatus();
+        }
+    };
+    showAheadBehind();
+    // 启动拉取未结束时会检出文件到工作区, 编辑、检查、运行和切换实验要等它完成
+    auto pullPending = [&]()
+    {
+        if (!pull || pull->isFinished())
+            return false;
+        pullStatus = "pull: syncing";
+        showStatus();
+        beep();
+        return true;
+    };
+    // Shell面板跳到当前行之后的下一条诊断
+    auto jumpToNextIssue = [&]()
+    {
+        const shellDiagnostic *next = diagnostics->next(shellDisplay->currentLine() + 1);
+        if (next)
+            shellDisplay->jumpToLine(next->line - 1);
+    };
+    // 解析ShellCheck输出, 更新检查面板和Shell面板的标记栏
+    auto showDiagnostics = [&](const std::string &output)
+    {
+        checkDisplay->clearContent();
+        if (diagnostics->parse(output))
+        {
+            checkDisplay->appendText(diagnostics->format());
+            shellDisplay->setGutterMarks(diagnostics->gutter(shellDisplay->lineCount()));
+        }
+        else
+        {
+            checkDisplay->appendText(output);
+        }
+        checkDisplay->finishText();
+    };
 
     shellDisplay->run();
     demandDisplay->run();
@@ -2007,9 +7423,62 @@ void mainProgram(const nlohmann::json &student, const std::filesystem::path &wor
     int ch;
     curs_set(0);
     bool run = true;
+    bool pullReported = (pull == nullptr);
+    // 空闲时在后台做一次仓库维护
+    std::thread maintenanceWorker;
+    auto lastInput = std::chrono::steady_clock::now();
     while (run)
     {
+        // 后台拉取或推送未结束时轮询输入, 以便及时刷新面板和状态
+        bool pushBusy = pushes->busy();
+        if (!pullReported || pushBusy || lint->busy())
+            timeout(100);
+        else if (!maintenanceWorker.joinable())
+            timeout(MAINTENANCE_IDLE_MS);
         ch = getch();
+        timeout(-1);
+        // 每次按键的处理记为一个事件, 超时返回不记录
+        traceSpan keySpan(ch == ERR ? nullptr : "key", "input");
+        if (ch != ERR)
+        {
+            perf->keyPressed();
+            lastInput = std::chrono::steady_clock::now();
+        }
+        else if (pullReported && !pushBusy && !maintenanceWorker.joinable() &&
+                 std::chrono::steady_clock::now() - lastInput >= std::chrono::milliseconds(MAINTENANCE_IDLE_MS))
+        {
+            maintenanceWorker = std::thread([workDir]()
+                                             { git_maintenance(workDir); });
+        }
+        if (pushBusy || pushes->status() == "ok")
+        {
+            pushStatus = "push: " + pushes->status();
+            showStatus();
+            if (pushBusy && !pushes->busy())
+                showAheadBehind();
+        }
+        if (!pullReported && pull->isFinished())
+        {
+            pullReported = true;
+            pushes->start();
+            if (pull->takeUpdate())
+            {
+                shellDisplay->reloadFile();
+                demandDisplay->reloadFile();
+                git->reinitialize(workDir / lab);
+            }
+            const char *pullText = pull->status() == GIT_ECONFLICT ? "conflict" : pull->status() < 0 ? "failed" : "done";
+            pullStatus = std::string("pull: ") + pullText;
+            showStatus();
+            showAheadBehind();
+        }
+        // 后台预检查完成后更新Shell面板的标记栏
+        std::string lintPath, lintOutput;
+        if (lint->takeFresh(lintPath, lintOutput) && lintPath == (workDir / lab / shellFile).string())
+        {
+            showDiagnostics(lintOutput);
+            shellDisplay->refreshDisplay();
+        }
         switch (ch)
         {
         case KEY_DOWN:
@@ -2028,9 +7497,12 @@ void mainProgram(const nlohmann::json &student, const std::filesystem::path &wor
 
         case 'l':
         {
+            if (pullPending())
+                break;
             top_panel(labPanel);
             update_panels();
             doupdate();
+            perf->painted();
             int choice = labChoice->run();
             if (choice == -1)
             {
@@ -2044,6 +7516,7 @@ void mainProgram(const nlohmann::json &student, const std::filesystem::path &wor
                 demandFile = dir[choice] + ".txt";
                 shellFile = dir[choice] + ".sh";
                 recordFile = dir[choice] + ".cast";
+                diagnostics->clear();
                 shellDisplay->changeFile(workDir/lab/shellFile);
                 shellDisplay->run();
                 demandDisplay->changeFile(workDir/lab / demandFile);
@@ -2058,12 +7531,28 @@ void mainProgram(const nlohmann::json &student, const std::filesystem::path &wor
 
         case 'c':
         {
+            if (pullPending())
+                break;
             bool run1 = true;
             top_panel(checkPanel);
             update_panels();
             doupdate();
-            runShellCheck(workDir/lab/shellFile);
-            checkDisplay->reloadFile();
+            perf->painted();
+            // json1 格式在 ShellCheck 结束时一次输出, 收齐后再解析显示
+            std::string output;
+            if (!lint->take(workDir / lab / shellFile, output))
+            {
+                // 没有就绪的后台结果时才运行ShellCheck(只启动一次进程)
+                checkDisplay->clearContent();
+                checkDisplay->appendText("Running shellcheck...");
+                checkDisplay->finishText();
+                checkDisplay->refreshDisplay();
+                runShellCheckCached(workDir, workDir / lab / shellFile, [&](const char *data, size_t len)
+                                    { output.append(data, len); });
+            }
+            showDiagnostics(output);
+            checkDisplay->refreshDisplay();
+            bool jumpNext = false;
             while (run1)
             {
                 int ch = wgetch(checkWin);
@@ -2072,15 +7561,93 @@ void mainProgram(const nlohmann::json &student, const std::filesystem::path &wor
                     run1 = false;
                     break;
                 }
+                else if (ch == 'n')
+                {
+                    // 关闭检查面板, 在Shell面板中跳到下一条诊断
+                    jumpNext = true;
+                    run1 = false;
+                    break;
+                }
                 else
                 {
+                    perf->keyPressed();
                     checkDisplay->handleInput(ch);
+                    perf->painted();
                     run1 = true;
                 }
             }
             top_panel(mainPanel);
             update_panels();
             doupdate();
+            // 显示新的标记栏
+            if (jumpNext)
+                jumpToNextIssue();
+            shellDisplay->refreshDisplay();
+            break;
+        }
+
+        case 'h':
+        {
+            // 补全浅仓库历史会和启动拉取同时写 .git/shallow
+            if (pullPending())
+                break;
+            top_panel(historyPanel);
+            update_panels();
+            doupdate();
+            perf->painted();
+            history->open();
+            int key;
+            while ((key = wgetch(historyWin)) != 'q')
+            {
+                perf->keyPressed();
+                history->handleInput(key);
+                perf->painted();
+            }
+            history->close();
+            top_panel(mainPanel);
+            update_panels();
+            doupdate();
+            break;
+        }
+
+        case 'r':
+        {
+            if (pullPending())
+                break;
+            top_panel(runPanel);
+            update_panels();
+            doupdate();
+            perf->painted();
+            runner->run(workDir / lab / shellFile, runLimits);
+            top_panel(mainPanel);
+            update_panels();
+            doupdate();
+            break;
+        }
+
+        case 'p':
+        {
+            top_panel(playbackPanel);
+            update_panels();
+            doupdate();
+            perf->painted();
+            playback->open(workDir / lab / recordFile);
+            int key;
+            while ((key = wgetch(playbackWin)) != 'q')
+            {
+                if (key == ERR)
+                    playback->tick();
+                else
+                {
+                    perf->keyPressed();
+                    playback->handleInput(key);
+                    perf->painted();
+                }
+            }
+            playback->close();
+            top_panel(mainPanel);
+            update_panels();
+            doupdate();
             break;
         }
 
@@ -2089,10 +7656,13 @@ void mainProgram(const nlohmann::json &student, const std::filesystem::path &wor
             top_panel(gitPanel);
             update_panels();
             doupdate();
+            perf->painted();
             std::string commitMessage = git->run();
             //commitMessage.erase(std::remove(commitMessage.begin(), commitMessage.end(), ' '), commitMessage.end());
             if (!commitMessage.empty())
             {
+                if (pull)
+                    pull->wait();
                 git_add_all(workDir);
                 use_git_commit(workDir, commitMessage);
             }
@@ -2100,6 +7670,7 @@ void mainProgram(const nlohmann::json &student, const std::filesystem::path &wor
             top_panel(mainPanel);
             update_panels();
             doupdate();
+            showAheadBehind();
             break;
         }
 
@@ -2108,6 +7679,7 @@ void mainProgram(const nlohmann::json &student, const std::filesystem::path &wor
             top_panel(exitPanel);
             update_panels();
             doupdate();
+            perf->painted();
             int choice = labExit->run();
             if (choice == -1)
             {
@@ -2117,7 +7689,16 @@ void mainProgram(const nlohmann::json &student, const std::filesystem::path &wor
             }
             else if (choice == 0)
             {
-                use_git_push(workDir, gitUrl);
+                if (pull)
+                    pull->wait();
+                pushes->start();
+                pushes->enqueue();
+                top_panel(mainPanel);
+                update_panels();
+                pushStatus = "push: pushing";
+                showStatus();
+                // 网络不可用时不阻塞退出, 日志保留到下次启动继续推送
+                pushes->flush(PUSH_EXIT_WAIT_MS);
                 run = false;
             }
             else
@@ -2129,16 +7710,87 @@ void mainProgram(const nlohmann::json &student, const std::filesystem::path &wor
 
         case 's':
         {
-            record_with_asciinema(editor, workDir / lab / shellFile, workDir / lab / recordFile);
+            if (pullPending())
+                break;
+            std::string before, after;
+            read_file(workDir / lab / shellFile, before);
+            int editHeight, editWidth;
+            getmaxyx(editWin, editHeight, editWidth);
+            if (editHeight >= EDIT_PANE_MIN_ROWS && editWidth >= EDIT_PANE_MIN_COLS)
+            {
+                // 编辑器画在Shell面板内, Demand面板保持可见
+                mvwprintw(shellWin, 0, 1, "Shell [%s]", editor.c_str());
+                wrefresh(shellWin);
+                perf->painted();
+                edit_in_pane(editWin, editor, workDir / lab / shellFile, workDir / lab / recordFile);
+                box(shellWin, 0, 0);
+                mvwprintw(shellWin, 0, 1, "Shell");
+                wrefresh(shellWin);
+            }
+            else
+            {
+                // 终端太小时退出ncurses全屏编辑(整个会话不计入按键延迟)
+                perf->discard();
+                record_session(editor, workDir / lab / shellFile, workDir / lab / recordFile);
+            }
             shellDisplay->reloadFile();
+            // 脚本有变化时在后台预先检查, 旧的标记已失效
+            read_file(workDir / lab / shellFile, after);
+            if (after != before)
+            {
+                diagnostics->clear();
+                shellDisplay->setGutterMarks({});
+                shellDisplay->refreshDisplay();
+                lint->start(workDir, workDir / lab / shellFile);
+            }
+            // 统计新会话的编辑行为
+            update_student_summaries(workDir, {lab});
+            break;
+        }
+
+        case KEY_F(12):
+        {
+            // 隐藏按键: 显示/关闭性能浮层
+            hudVisible = !hudVisible;
+            perf->discard();
+            if (hudVisible)
+            {
+                showHud();
+            }
+            else
+            {
+                hide_panel(hudPanel);
+                update_panels();
+                touchwin(mainWin);
+                wrefresh(mainWin);
+            }
+            break;
+        }
+
+        case 'n':
+        {
+            jumpToNextIssue();
             break;
         }
 
         default:
+            perf->discard();
             break;
         }
+        if (ch != ERR)
+        {
+            perf->painted();
+            if (hudVisible)
+                showHud();
+        }
     }
 
+    if (maintenanceWorker.joinable())
+        maintenanceWorker.join();
+
+    // 保存本次运行的延迟统计
+    perf->dump(workDir / ".git" / "lab-perf.jsonl");
+
     // 清理释放
     delete shellDisplay;
     delete demandDisplay;
@@ -2146,32 +7798,114 @@ void mainProgram(const nlohmann::json &student, const std::filesystem::path &wor
     delete git;
     delete labChoice;
     delete labExit;
-
+    // 卡在网络上的推送线程仍在使用队列对象, 此时不释放, 随进程退出结束
+    bool pushStopped = pushes->stop(PUSH_CANCEL_WAIT_MS);
+    if (pushStopped)
+        delete pushes;
+    delete history;
+    delete playback;
+    delete perf;
+    delete runner;
+    delete lint;
+    delete diagnostics;
+
+    del_panel(hudPanel);
+    del_panel(runPanel);
+    del_panel(playbackPanel);
+    del_panel(historyPanel);
     del_panel(exitPanel);
     del_panel(labPanel);
     del_panel(checkPanel);
     del_panel(gitPanel);
     del_panel(mainPanel);
 
+    delwin(hudWin);
+    delwin(runWin);
+    delwin(playbackWin);
+    delwin(historyWin);
     delwin(exitWin);
     delwin(labWin);
     delwin(checkWin);
     delwin(gitWin);
     delwin(buttonWIN);
     delwin(demandWin);
+    delwin(editWin);
     delwin(shellWin);
     delwin(mainWin);
+    return pushStopped;
 }
 
+#ifndef LAB_BENCH // bench.cpp 包含本文件时使用自己的 main
 int main(int argc, char *argv[])
 {
 
+    // --trace out.json 记录各阶段耗时
+    if (argc >= 3 && std::string(argv[1]) == "--trace")
+    {
+        trace_enable(argv[2]);
+        argv[2] = argv[0];
+        argv += 2;
+        argc -= 2;
+    }
     if (argc < 2)
     {
-        std::cout << "Usage: " << argv[0] << " <dirname,your git repository>" << std::endl;
+        std::cout << "Usage: " << argv[0] << " [--trace out.json] <dirname,your git repository>" << std::endl;
+        std::cout << "       " << argv[0] << " --analyze <dirname>..." << std::endl;
+        std::cout << "       " << argv[0] << " --batch [--report file] [--net-jobs n] [--cpu-jobs n] <dirname>..." << std::endl;
+        std::cout << "       " << argv[0] << " --grade [--report file] [--jobs n] [--spec-dir dir] <dirname>..." << std::endl;
         return 1;
     }
+    if (std::string(argv[1]) == "--grade")
+    {
+        // 不进入界面: 按 Require/labN.tests.json 运行各仓库的脚本并评分
+        gradeOptions options;
+        for (int i = 2; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+            if (arg == "--report" && i + 1 < argc)
+                options.report = argv[++i];
+            else if (arg == "--jobs" && i + 1 < argc)
+                options.jobs = std::max(1, std::atoi(argv[++i]));
+            else if (arg == "--spec-dir" && i + 1 < argc)
+                options.specDir = argv[++i];
+            else
+                options.dirs.push_back(arg);
+        }
+        int status = run_grading(options);
+        remove_session_runtime_dir();
+        trace_write();
+        return status;
+    }
+    if (std::string(argv[1]) == "--batch")
+    {
+        // 不进入界面: 拉取、检查、提交并推送每个仓库
+        batchOptions options;
+        for (int i = 2; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+            if (arg == "--report" && i + 1 < argc)
+                options.report = argv[++i];
+            else if (arg == "--net-jobs" && i + 1 < argc)
+                options.netJobs = std::max(1, std::atoi(argv[++i]));
+            else if (arg == "--cpu-jobs" && i + 1 < argc)
+                options.cpuJobs = std::max(1, std::atoi(argv[++i]));
+            else
+                options.dirs.push_back(arg);
+        }
+        git_libgit2_init();
+        int status = run_batch(options);
+        git_libgit2_shutdown();
+        trace_write();
+        return status;
+    }
+    if (std::string(argv[1]) == "--analyze")
+    {
+        // 不进入界面, 统计各学生仓库的录像后退出
+        return analyze_class(std::vector<std::string>(argv + 2, argv + argc));
+    }
     git_libgit2_init();
+    // 使用环境中的locale, ncursesw 才能正确显示UTF-8和中文宽字符
+    setlocale(LC_ALL, "");
     // 初始化ncurses
     initscr();
     start_color();
@@ -2180,9 +7914,9 @@ int main(int argc, char *argv[])
     keypad(stdscr, TRUE);
     curs_set(0);
     refresh();
-    welcome();
 
     std::filesystem::path workDir = argv[1];
+    asyncPull *pull = nullptr;
     if (std::filesystem::exists(workDir))
     {
         if (!std::filesystem::is_directory(workDir))
@@ -2192,13 +7926,16 @@ int main(int argc, char *argv[])
         }
         if (std::filesystem::is_empty(workDir))
         {
+            // 仅首次使用时显示欢迎界面
+            welcome();
             init(workDir);
         }
         else if (std::filesystem::exists(workDir / ".git"))
         {
             std::string workDirStr = workDir.string();
             //system("git pull ");
-            use_git_pull(workDirStr);
+            // 拉取在后台进行, 实验菜单直接使用本地 student.json
+            pull = new asyncPull(workDirStr, load_pull_options(workDir));
         }
         else
         {
@@ -2212,15 +7949,31 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    std::ifstream file(workDir / "student.json");
     nlohmann::json student;
-    file >> student;
-    file.close();
+    {
+        TRACE_SPAN("student.json", "startup");
+        std::ifstream file(workDir / "student.json");
+        file >> student;
+        file.close();
+    }
     std::string lab = lab_choice(student);
     refresh();
-    mainProgram(student, workDir, lab);
+    bool pushStopped = mainProgram(student, workDir, lab, pull);
+    delete pull;
+    // 退出时松散对象过多则打包(未超过阈值时只扫描目录)
+    // 推送线程未退出时不能整理仓库, 也不能关闭libgit2, 直接结束进程, 推送日志下次启动继续
+    if (pushStopped)
+        git_maintenance(workDir);
     clear();
     endwin();
+    remove_session_runtime_dir();
+    trace_write();
+    if (!pushStopped)
+    {
+        std::cout.flush();
+        _exit(0);
+    }
     git_libgit2_shutdown();
     return 0;
-}
\ No newline at end of file
+}
+#endif